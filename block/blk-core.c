@@ -122,6 +122,7 @@ void blk_rq_init(struct request_queue *q, struct request *rq)
 	rq->ref_count = 1;
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
+	blk_latency_hist_queued(rq);
 	rq->part = NULL;
 }
 EXPORT_SYMBOL(blk_rq_init);
@@ -1432,6 +1433,7 @@ void blk_dequeue_request(struct request *rq)
 	BUG_ON(ELV_ON_HASH(rq));
 
 	list_del_init(&rq->queuelist);
+	blk_latency_hist_dispatched(rq);
 
 	if (blk_account_rq(rq)) {
 		q->in_flight[rq_is_sync(rq)]++;
@@ -1624,6 +1626,7 @@ static void blk_finish_request(struct request *req, int error)
 	if (req->cmd_flags & REQ_DONTPREP)
 		blk_unprep_request(req);
 
+	blk_latency_hist_done(req);
 
 	blk_account_io_done(req);
 
@@ -0,0 +1,271 @@
+/*
+ * Per queue I/O latency histograms
+ *
+ * For every request that goes through a queue with the histograms
+ * enabled, the time it waited between allocation and dispatch to the
+ * driver, and the time the driver took from dispatch to completion,
+ * are added to a log2 histogram.  Requests are told apart by type
+ * (read, write, flush, discard), sync flag and size.
+ *
+ * Histograms are enabled with /sys/block/<disk>/queue/latency_hist and
+ * read from <debugfs>/blk_latency/<disk>; writing to the latter resets
+ * them.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+
+#include "blk.h"
+
+/* Bucket 0 is < 64 us, bucket n is < 64 << n us, the last is open. */
+#define BLK_LAT_BUCKETS		16
+#define BLK_LAT_SIZES		5
+
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE,
+	BLK_LAT_FLUSH,
+	BLK_LAT_DISCARD,
+	BLK_LAT_TYPES,
+};
+
+enum {
+	BLK_LAT_WAIT,
+	BLK_LAT_SERVICE,
+	BLK_LAT_PHASES,
+};
+
+struct blk_latency_stat {
+	u32 hist[BLK_LAT_BUCKETS];
+	u32 max_us;
+	u64 total_us;
+};
+
+struct blk_latency_hist {
+	struct dentry *dentry;
+	struct blk_latency_stat
+		stat[BLK_LAT_TYPES][2][BLK_LAT_SIZES][BLK_LAT_PHASES];
+};
+
+static const char *const blk_lat_type_names[BLK_LAT_TYPES] = {
+	"read", "write", "flush", "discard",
+};
+
+static const char *const blk_lat_size_names[BLK_LAT_SIZES] = {
+	"4K", "16K", "64K", "256K", ">256K",
+};
+
+static struct dentry *blk_lat_root;
+
+static int blk_lat_size(unsigned int bytes)
+{
+	int i;
+
+	for (i = 0; i < BLK_LAT_SIZES - 1; i++)
+		if (bytes <= (4096U << (2 * i)))
+			break;
+	return i;
+}
+
+static void blk_lat_add(struct blk_latency_stat *st, u64 ns)
+{
+	u64 us = div_u64(ns, NSEC_PER_USEC);
+	int bucket = us < 64 ? 0 : fls64(us >> 6);
+
+	st->hist[min(bucket, BLK_LAT_BUCKETS - 1)]++;
+	st->total_us += us;
+	if (us > st->max_us)
+		st->max_us = min_t(u64, us, UINT_MAX);
+}
+
+/* Called with the queue lock held, when rq is done. */
+void blk_latency_hist_done(struct request *rq)
+{
+	struct blk_latency_hist *h = rq->q->latency_hist;
+	struct blk_latency_stat *st;
+	int type, sync;
+	u64 now;
+
+	if (!h || rq->cmd_type != REQ_TYPE_FS ||
+	    !rq->lat_queue_ns || !rq->lat_start_ns)
+		return;
+
+	if (rq->cmd_flags & REQ_FLUSH)
+		type = BLK_LAT_FLUSH;
+	else if (rq->cmd_flags & REQ_DISCARD)
+		type = BLK_LAT_DISCARD;
+	else if (rq_data_dir(rq) == WRITE)
+		type = BLK_LAT_WRITE;
+	else
+		type = BLK_LAT_READ;
+	sync = rq_is_sync(rq) ? 1 : 0;
+
+	st = h->stat[type][sync][blk_lat_size(rq->lat_bytes)];
+	now = ktime_to_ns(ktime_get());
+	if (rq->lat_start_ns > rq->lat_queue_ns)
+		blk_lat_add(&st[BLK_LAT_WAIT],
+			    rq->lat_start_ns - rq->lat_queue_ns);
+	if (now > rq->lat_start_ns)
+		blk_lat_add(&st[BLK_LAT_SERVICE], now - rq->lat_start_ns);
+}
+
+static void blk_lat_print(struct seq_file *s, int type, int sync, int size,
+			  int phase, struct blk_latency_stat *st)
+{
+	u32 n = 0;
+	int i;
+
+	for (i = 0; i < BLK_LAT_BUCKETS; i++)
+		n += st->hist[i];
+	if (!n)
+		return;
+
+	seq_printf(s, "%-7s %-5s %-5s %-7s %8u %8llu %8u ",
+		   blk_lat_type_names[type], sync ? "sync" : "async",
+		   blk_lat_size_names[size],
+		   phase == BLK_LAT_WAIT ? "wait" : "service",
+		   n, div_u64(st->total_us, n), st->max_us);
+	for (i = 0; i < BLK_LAT_BUCKETS; i++)
+		seq_printf(s, " %u", st->hist[i]);
+	seq_putc(s, '\n');
+}
+
+static int blk_lat_show(struct seq_file *s, void *data)
+{
+	struct request_queue *q = s->private;
+	struct blk_latency_hist *snap;
+	int type, sync, size, phase, i;
+
+	snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	mutex_lock(&q->sysfs_lock);
+	if (!q->latency_hist) {
+		mutex_unlock(&q->sysfs_lock);
+		kfree(snap);
+		seq_puts(s, "disabled\n");
+		return 0;
+	}
+	spin_lock_irq(q->queue_lock);
+	memcpy(snap, q->latency_hist, sizeof(*snap));
+	spin_unlock_irq(q->queue_lock);
+	mutex_unlock(&q->sysfs_lock);
+
+	seq_puts(s, "type    sync  size  phase          n   avg_us   max_us "
+		 " buckets, us:");
+	for (i = 0; i < BLK_LAT_BUCKETS - 1; i++)
+		seq_printf(s, " <%u", 64U << i);
+	seq_printf(s, " >=%u\n", 64U << (i - 1));
+
+	for (type = 0; type < BLK_LAT_TYPES; type++)
+		for (sync = 0; sync < 2; sync++)
+			for (size = 0; size < BLK_LAT_SIZES; size++)
+				for (phase = 0; phase < BLK_LAT_PHASES; phase++)
+					blk_lat_print(s, type, sync, size,
+						phase, &snap->stat[type][sync]
+							[size][phase]);
+	kfree(snap);
+	return 0;
+}
+
+static int blk_lat_open(struct inode *inode, struct file *file)
+{
+	struct request_queue *q = inode->i_private;
+	int ret;
+
+	if (!blk_get_queue(q))
+		return -ENXIO;
+	ret = single_open(file, blk_lat_show, q);
+	if (ret)
+		blk_put_queue(q);
+	return ret;
+}
+
+static int blk_lat_release(struct inode *inode, struct file *file)
+{
+	struct request_queue *q = inode->i_private;
+	int ret = single_release(inode, file);
+
+	blk_put_queue(q);
+	return ret;
+}
+
+/* Any write resets the histograms. */
+static ssize_t blk_lat_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct seq_file *s = file->private_data;
+	struct request_queue *q = s->private;
+	struct blk_latency_hist *h;
+
+	mutex_lock(&q->sysfs_lock);
+	h = q->latency_hist;
+	if (h) {
+		spin_lock_irq(q->queue_lock);
+		memset(h->stat, 0, sizeof(h->stat));
+		spin_unlock_irq(q->queue_lock);
+	}
+	mutex_unlock(&q->sysfs_lock);
+	return count;
+}
+
+static const struct file_operations blk_lat_fops = {
+	.owner		= THIS_MODULE,
+	.open		= blk_lat_open,
+	.read		= seq_read,
+	.write		= blk_lat_write,
+	.llseek		= seq_lseek,
+	.release	= blk_lat_release,
+};
+
+/*
+ * Turns the histograms of q on or off.  Called with q->sysfs_lock
+ * held, the queue being registered, so that its kobject parent is the
+ * disk the debugfs file is named after.
+ */
+int blk_latency_hist_set(struct request_queue *q, bool on)
+{
+	struct blk_latency_hist *h = q->latency_hist;
+
+	if (on == !!h)
+		return 0;
+
+	if (!on) {
+		spin_lock_irq(q->queue_lock);
+		q->latency_hist = NULL;
+		spin_unlock_irq(q->queue_lock);
+		debugfs_remove(h->dentry);
+		kfree(h);
+		return 0;
+	}
+
+	if (!blk_lat_root || !q->kobj.parent)
+		return -ENODEV;
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+	h->dentry = debugfs_create_file(kobject_name(q->kobj.parent),
+					S_IRUSR | S_IWUSR, blk_lat_root, q,
+					&blk_lat_fops);
+	if (!h->dentry) {
+		kfree(h);
+		return -ENOMEM;
+	}
+
+	spin_lock_irq(q->queue_lock);
+	q->latency_hist = h;
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+
+static int __init blk_latency_hist_init(void)
+{
+	blk_lat_root = debugfs_create_dir("blk_latency", NULL);
+	return 0;
+}
+subsys_initcall(blk_latency_hist_init);
@@ -173,4 +173,31 @@ static inline void blk_throtl_exit(struct request_queue *q) { }
 static inline void blk_throtl_release(struct request_queue *q) { }
 #endif 
 
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+extern void blk_latency_hist_done(struct request *rq);
+extern int blk_latency_hist_set(struct request_queue *q, bool on);
+
+static inline void blk_latency_hist_queued(struct request *rq)
+{
+	if (rq->q && rq->q->latency_hist)
+		rq->lat_queue_ns = ktime_to_ns(ktime_get());
+}
+
+static inline void blk_latency_hist_dispatched(struct request *rq)
+{
+	if (rq->q->latency_hist) {
+		rq->lat_start_ns = ktime_to_ns(ktime_get());
+		rq->lat_bytes = blk_rq_bytes(rq);
+	}
+}
+#else
+static inline void blk_latency_hist_done(struct request *rq) { }
+static inline int blk_latency_hist_set(struct request_queue *q, bool on)
+{
+	return 0;
+}
+static inline void blk_latency_hist_queued(struct request *rq) { }
+static inline void blk_latency_hist_dispatched(struct request *rq) { }
+#endif
+
 #endif 
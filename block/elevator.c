@@ -591,6 +591,8 @@ void __elv_add_request(struct request_queue *q, struct request *rq, int where)
 		}
 
 		q->elevator->type->ops.elevator_add_req_fn(q, rq);
+		if ((rq->cmd_flags & REQ_URGENT) && q->urgent_request_fn)
+			q->urgent_request_fn(q);
 		break;
 
 	case ELEVATOR_INSERT_FLUSH:
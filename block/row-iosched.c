@@ -0,0 +1,435 @@
+/*
+ *  ROW (Read Over Write) i/o scheduler.
+ *
+ *  Meant for eMMC and similar flash devices: there is no seek penalty to
+ *  optimise for, but a write can keep the card busy for a long time, and
+ *  a reader waiting behind a batch of writes is what the user notices.
+ *
+ *  Requests are sorted into four FIFO queues, served in strict priority
+ *  order:
+ *
+ *	urgent		reads flagged REQ_META/REQ_PRIO or of the RT io class
+ *	read		all other reads
+ *	sync write	writes somebody waits for (fsync, O_SYNC, O_DIRECT)
+ *	async write	writeback
+ *
+ *  To bound write starvation, a write queue gets a batch of write_batch
+ *  requests when its oldest request has waited longer than its expire
+ *  time, or after writes_starved reads were dispatched while it waited.
+ *
+ *  When the read queues run empty right after a sequential read, the
+ *  scheduler holds writes back for up to read_idle ms, so that the next
+ *  read of the stream does not find the card busy with a write.
+ *
+ *  Urgent requests, and all reads unless read_urgent is cleared, are
+ *  flagged REQ_URGENT, which lets a driver that supports it put back a
+ *  write it was about to start and serve the read first.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/hrtimer.h>
+#include <linux/iocontext.h>
+#include <linux/ioprio.h>
+
+enum row_prio {
+	ROWQ_URGENT,
+	ROWQ_READ,
+	ROWQ_SYNC_WRITE,
+	ROWQ_ASYNC_WRITE,
+	ROWQ_MAX_PRIO,
+};
+
+#define ROWQ_NONE	-1
+
+static const int sync_write_expire = HZ / 2;	/* max wait of a sync write */
+static const int async_write_expire = 5 * HZ;	/* max wait of writeback */
+static const int writes_starved = 16;	/* reads dispatched before a write batch */
+static const int write_batch = 4;	/* writes dispatched per batch */
+static const int read_idle = 5;		/* ms to hold writes for a sequential reader */
+static const int read_urgent = 1;	/* flag all reads REQ_URGENT */
+
+struct row_data {
+	struct request_queue *queue;
+	struct list_head fifo_list[ROWQ_MAX_PRIO];
+
+	int batch_prio;		/* write queue a batch is served from */
+	int batching;		/* requests dispatched in the current batch */
+	int starved;		/* reads dispatched while writes waited */
+
+	sector_t last_read_end;
+	bool read_seq;		/* last read continued the previous one */
+
+	struct hrtimer idle_timer;
+	struct work_struct kick_work;
+	bool idling;
+
+	int fifo_expire[ROWQ_MAX_PRIO];
+	int writes_starved;
+	int write_batch;
+	int read_idle;
+	int read_urgent;
+};
+
+static inline int row_rq_prio(struct request *rq)
+{
+	return (long)rq->elv.priv[0];
+}
+
+static int row_classify(struct request *rq)
+{
+	int ioclass = IOPRIO_PRIO_CLASS(req_get_ioprio(rq));
+
+	if (ioclass == IOPRIO_CLASS_NONE && current->io_context)
+		ioclass = task_ioprio_class(current->io_context);
+
+	if (rq->cmd_flags & REQ_URGENT)
+		return ROWQ_URGENT;
+
+	if (rq_data_dir(rq) == READ) {
+		if ((rq->cmd_flags & (REQ_META | REQ_PRIO)) ||
+		    ioclass == IOPRIO_CLASS_RT)
+			return ROWQ_URGENT;
+		return ROWQ_READ;
+	}
+	if (rq_is_sync(rq))
+		return ROWQ_SYNC_WRITE;
+	return ROWQ_ASYNC_WRITE;
+}
+
+static void row_stop_idling(struct row_data *rd)
+{
+	if (rd->idling) {
+		hrtimer_try_to_cancel(&rd->idle_timer);
+		rd->idling = false;
+	}
+}
+
+static void row_add_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	int prio = row_classify(rq);
+
+	rq->elv.priv[0] = (void *)(long)prio;
+	if (prio == ROWQ_URGENT || (prio == ROWQ_READ && rd->read_urgent))
+		rq->cmd_flags |= REQ_URGENT;
+	rq_set_fifo_time(rq, jiffies + rd->fifo_expire[prio]);
+	list_add_tail(&rq->queuelist, &rd->fifo_list[prio]);
+
+	/* The read we were idling for has come; the queue runs next. */
+	if (prio <= ROWQ_READ)
+		row_stop_idling(rd);
+}
+
+static void row_merged_requests(struct request_queue *q, struct request *rq,
+				struct request *next)
+{
+	/*
+	 * rq takes over the place of next if next was queued at a higher
+	 * priority or has been waiting longer.
+	 */
+	if (row_rq_prio(next) < row_rq_prio(rq) ||
+	    (row_rq_prio(next) == row_rq_prio(rq) &&
+	     time_before(rq_fifo_time(next), rq_fifo_time(rq)))) {
+		list_move(&rq->queuelist, &next->queuelist);
+		rq_set_fifo_time(rq, rq_fifo_time(next));
+		rq->elv.priv[0] = next->elv.priv[0];
+		rq->cmd_flags |= next->cmd_flags & REQ_URGENT;
+	}
+
+	rq_fifo_clear(next);
+}
+
+static void row_dispatch_insert(struct row_data *rd, struct request *rq)
+{
+	if (row_rq_prio(rq) <= ROWQ_READ) {
+		rd->read_seq = blk_rq_pos(rq) == rd->last_read_end;
+		rd->last_read_end = rq_end_sector(rq);
+	}
+
+	rq_fifo_clear(rq);
+	elv_dispatch_add_tail(rd->queue, rq);
+}
+
+static inline bool row_write_expired(struct row_data *rd, int prio)
+{
+	struct request *rq = rq_entry_fifo(rd->fifo_list[prio].next);
+
+	return time_after(jiffies, rq_fifo_time(rq));
+}
+
+/* Picks the queue to dispatch from, or ROWQ_NONE to wait. */
+static int row_select_queue(struct row_data *rd)
+{
+	int read_prio = ROWQ_NONE;
+	int prio;
+
+	/* Urgent requests do not wait for a write batch to finish. */
+	if (!list_empty(&rd->fifo_list[ROWQ_URGENT]))
+		rd->batch_prio = ROWQ_NONE;
+
+	if (rd->batch_prio != ROWQ_NONE) {
+		if (rd->batching < rd->write_batch &&
+		    !list_empty(&rd->fifo_list[rd->batch_prio]))
+			return rd->batch_prio;
+		rd->batch_prio = ROWQ_NONE;
+	}
+
+	for (prio = ROWQ_URGENT; prio <= ROWQ_READ; prio++) {
+		if (!list_empty(&rd->fifo_list[prio])) {
+			read_prio = prio;
+			break;
+		}
+	}
+
+	for (prio = ROWQ_SYNC_WRITE; prio < ROWQ_MAX_PRIO; prio++) {
+		if (list_empty(&rd->fifo_list[prio]))
+			continue;
+		if (read_prio == ROWQ_NONE) {
+			if (rd->idling)
+				return ROWQ_NONE;
+			if (rd->read_seq && rd->read_idle) {
+				/* Give the sequential reader a chance first. */
+				rd->read_seq = false;
+				rd->idling = true;
+				hrtimer_start(&rd->idle_timer,
+					      ktime_set(0, rd->read_idle *
+							NSEC_PER_MSEC),
+					      HRTIMER_MODE_REL);
+				return ROWQ_NONE;
+			}
+			goto start_batch;
+		}
+		if (row_write_expired(rd, prio) ||
+		    rd->starved >= rd->writes_starved)
+			goto start_batch;
+	}
+
+	if (read_prio != ROWQ_NONE &&
+	    (!list_empty(&rd->fifo_list[ROWQ_SYNC_WRITE]) ||
+	     !list_empty(&rd->fifo_list[ROWQ_ASYNC_WRITE])))
+		rd->starved++;
+	return read_prio;
+
+start_batch:
+	rd->batch_prio = prio;
+	rd->batching = 0;
+	rd->starved = 0;
+	return prio;
+}
+
+static int row_dispatch_requests(struct request_queue *q, int force)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct request *rq;
+	int prio, dispatched = 0;
+
+	if (unlikely(force)) {
+		row_stop_idling(rd);
+		for (prio = ROWQ_URGENT; prio < ROWQ_MAX_PRIO; prio++) {
+			while (!list_empty(&rd->fifo_list[prio])) {
+				rq = rq_entry_fifo(rd->fifo_list[prio].next);
+				row_dispatch_insert(rd, rq);
+				dispatched++;
+			}
+		}
+		rd->batch_prio = ROWQ_NONE;
+		return dispatched;
+	}
+
+	prio = row_select_queue(rd);
+	if (prio == ROWQ_NONE)
+		return 0;
+
+	if (prio == rd->batch_prio)
+		rd->batching++;
+	rq = rq_entry_fifo(rd->fifo_list[prio].next);
+	row_dispatch_insert(rd, rq);
+	return 1;
+}
+
+static struct request *
+row_former_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	if (rq->queuelist.prev == &rd->fifo_list[row_rq_prio(rq)])
+		return NULL;
+	return list_entry(rq->queuelist.prev, struct request, queuelist);
+}
+
+static struct request *
+row_latter_request(struct request_queue *q, struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+
+	if (rq->queuelist.next == &rd->fifo_list[row_rq_prio(rq)])
+		return NULL;
+	return list_entry(rq->queuelist.next, struct request, queuelist);
+}
+
+static void row_kick_queue(struct work_struct *work)
+{
+	struct row_data *rd = container_of(work, struct row_data, kick_work);
+	struct request_queue *q = rd->queue;
+
+	spin_lock_irq(q->queue_lock);
+	rd->idling = false;
+	__blk_run_queue(q);
+	spin_unlock_irq(q->queue_lock);
+}
+
+static enum hrtimer_restart row_idle_timer(struct hrtimer *timer)
+{
+	struct row_data *rd = container_of(timer, struct row_data, idle_timer);
+
+	kblockd_schedule_work(rd->queue, &rd->kick_work);
+	return HRTIMER_NORESTART;
+}
+
+static void *row_init_queue(struct request_queue *q)
+{
+	struct row_data *rd;
+	int prio;
+
+	rd = kmalloc_node(sizeof(*rd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!rd)
+		return NULL;
+
+	rd->queue = q;
+	for (prio = ROWQ_URGENT; prio < ROWQ_MAX_PRIO; prio++)
+		INIT_LIST_HEAD(&rd->fifo_list[prio]);
+	rd->batch_prio = ROWQ_NONE;
+	rd->fifo_expire[ROWQ_SYNC_WRITE] = sync_write_expire;
+	rd->fifo_expire[ROWQ_ASYNC_WRITE] = async_write_expire;
+	rd->writes_starved = writes_starved;
+	rd->write_batch = write_batch;
+	rd->read_idle = read_idle;
+	rd->read_urgent = read_urgent;
+
+	hrtimer_init(&rd->idle_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	rd->idle_timer.function = row_idle_timer;
+	INIT_WORK(&rd->kick_work, row_kick_queue);
+	return rd;
+}
+
+static void row_exit_queue(struct elevator_queue *e)
+{
+	struct row_data *rd = e->elevator_data;
+	int prio;
+
+	hrtimer_cancel(&rd->idle_timer);
+	cancel_work_sync(&rd->kick_work);
+
+	for (prio = ROWQ_URGENT; prio < ROWQ_MAX_PRIO; prio++)
+		BUG_ON(!list_empty(&rd->fifo_list[prio]));
+
+	kfree(rd);
+}
+
+
+static ssize_t
+row_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+row_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return row_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(row_sync_write_expire_show, rd->fifo_expire[ROWQ_SYNC_WRITE], 1);
+SHOW_FUNCTION(row_async_write_expire_show, rd->fifo_expire[ROWQ_ASYNC_WRITE], 1);
+SHOW_FUNCTION(row_writes_starved_show, rd->writes_starved, 0);
+SHOW_FUNCTION(row_write_batch_show, rd->write_batch, 0);
+SHOW_FUNCTION(row_read_idle_show, rd->read_idle, 0);
+SHOW_FUNCTION(row_read_urgent_show, rd->read_urgent, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct row_data *rd = e->elevator_data;				\
+	int __data;							\
+	int ret = row_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(row_sync_write_expire_store, &rd->fifo_expire[ROWQ_SYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(row_async_write_expire_store, &rd->fifo_expire[ROWQ_ASYNC_WRITE], 0, INT_MAX, 1);
+STORE_FUNCTION(row_writes_starved_store, &rd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(row_write_batch_store, &rd->write_batch, 1, INT_MAX, 0);
+STORE_FUNCTION(row_read_idle_store, &rd->read_idle, 0, 100, 0);
+STORE_FUNCTION(row_read_urgent_store, &rd->read_urgent, 0, 1, 0);
+#undef STORE_FUNCTION
+
+#define ROW_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, row_##name##_store)
+
+static struct elv_fs_entry row_attrs[] = {
+	ROW_ATTR(sync_write_expire),
+	ROW_ATTR(async_write_expire),
+	ROW_ATTR(writes_starved),
+	ROW_ATTR(write_batch),
+	ROW_ATTR(read_idle),
+	ROW_ATTR(read_urgent),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_row = {
+	.ops = {
+		.elevator_merge_req_fn =	row_merged_requests,
+		.elevator_dispatch_fn =		row_dispatch_requests,
+		.elevator_add_req_fn =		row_add_request,
+		.elevator_former_req_fn =	row_former_request,
+		.elevator_latter_req_fn =	row_latter_request,
+		.elevator_init_fn =		row_init_queue,
+		.elevator_exit_fn =		row_exit_queue,
+	},
+
+	.elevator_attrs = row_attrs,
+	.elevator_name = "row",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init row_init(void)
+{
+	return elv_register(&iosched_row);
+}
+
+static void __exit row_exit(void)
+{
+	elv_unregister(&iosched_row);
+}
+
+module_init(row_init);
+module_exit(row_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Read Over Write IO scheduler");
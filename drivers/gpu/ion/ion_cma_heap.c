@@ -0,0 +1,393 @@
+/*
+ * drivers/gpu/ion/ion_cma_heap.c
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * A heap on top of the contiguous memory allocator.  Unlike a carveout,
+ * the memory behind it is handed to the page allocator for movable pages
+ * while no buffer uses it, and those pages are migrated away when a
+ * buffer is allocated.  Board code reserves the area for the heap's
+ * device with dma_declare_contiguous() and passes that device in
+ * struct ion_cma_heap_pdata.
+ */
+
+#include <linux/err.h>
+#include <linux/dma-mapping.h>
+#include <linux/dma-contiguous.h>
+#include <linux/io.h>
+#include <linux/ion.h>
+#include <linux/iommu.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include "ion_priv.h"
+
+#include <mach/iommu_domains.h>
+#include <asm/cacheflush.h>
+
+struct ion_cma_heap {
+	struct ion_heap heap;
+	struct device *dev;
+	atomic_t allocated_bytes;
+	unsigned int has_outer_cache;
+};
+
+/* ion_buffer->priv_virt */
+struct ion_cma_buffer_info {
+	void *cpu_addr;		/* kernel mapping */
+	dma_addr_t handle;	/* uncached buffers, from the DMA API */
+	ion_phys_addr_t phys;
+};
+
+#define to_cma_heap(x)	container_of(x, struct ion_cma_heap, heap)
+
+/*
+ * Uncached buffers come from the DMA API, which also remaps the lowmem
+ * alias of the pages so that no cacheable mapping of them remains.
+ * Cached buffers are taken from the area directly and used through the
+ * ordinary (cacheable) lowmem mapping.
+ */
+static int ion_cma_heap_allocate(struct ion_heap *heap,
+				 struct ion_buffer *buffer,
+				 unsigned long len, unsigned long align,
+				 unsigned long flags)
+{
+	struct ion_cma_heap *cma_heap = to_cma_heap(heap);
+	struct device *dev = cma_heap->dev;
+	struct ion_cma_buffer_info *info;
+	struct page *page;
+	int count;
+
+	len = PAGE_ALIGN(len);
+	count = len >> PAGE_SHIFT;
+
+	info = kzalloc(sizeof(struct ion_cma_buffer_info), GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+
+	if (!ION_IS_CACHED(flags)) {
+		info->cpu_addr = dma_alloc_writecombine(dev, len, &info->handle,
+							GFP_KERNEL);
+		if (!info->cpu_addr)
+			goto err;
+		info->phys = __pfn_to_phys(dma_to_pfn(dev, info->handle));
+	} else {
+		page = dma_alloc_from_contiguous(dev, count,
+				get_order(max_t(unsigned long, align, len)));
+		if (!page)
+			goto err;
+		if (PageHighMem(page)) {
+			pr_err("%s: heap %s is not in lowmem\n", __func__,
+			       heap->name);
+			dma_release_from_contiguous(dev, page, count);
+			goto err;
+		}
+		info->cpu_addr = page_address(page);
+		info->phys = page_to_phys(page);
+
+		/* the pages were someone else's a moment ago */
+		memset(info->cpu_addr, 0, len);
+		dmac_flush_range(info->cpu_addr, info->cpu_addr + len);
+		if (cma_heap->has_outer_cache)
+			outer_flush_range(info->phys, info->phys + len);
+	}
+
+	buffer->priv_virt = info;
+	atomic_add(len, &cma_heap->allocated_bytes);
+	return 0;
+
+err:
+	kfree(info);
+	return -ENOMEM;
+}
+
+static void ion_cma_heap_free(struct ion_buffer *buffer)
+{
+	struct ion_cma_heap *cma_heap = to_cma_heap(buffer->heap);
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+	size_t len = PAGE_ALIGN(buffer->size);
+
+	if (!ION_IS_CACHED(buffer->flags))
+		dma_free_writecombine(cma_heap->dev, len, info->cpu_addr,
+				      info->handle);
+	else
+		dma_release_from_contiguous(cma_heap->dev,
+					    virt_to_page(info->cpu_addr),
+					    len >> PAGE_SHIFT);
+
+	atomic_sub(len, &cma_heap->allocated_bytes);
+	kfree(info);
+	buffer->priv_virt = NULL;
+}
+
+static int ion_cma_heap_phys(struct ion_heap *heap,
+			     struct ion_buffer *buffer,
+			     ion_phys_addr_t *addr, size_t *len)
+{
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+
+	*addr = info->phys;
+	*len = buffer->size;
+	return 0;
+}
+
+static struct sg_table *ion_cma_heap_map_dma(struct ion_heap *heap,
+					     struct ion_buffer *buffer)
+{
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+	struct sg_table *table;
+	int ret;
+
+	table = kzalloc(sizeof(struct sg_table), GFP_KERNEL);
+	if (!table)
+		return ERR_PTR(-ENOMEM);
+
+	ret = sg_alloc_table(table, 1, GFP_KERNEL);
+	if (ret) {
+		kfree(table);
+		return ERR_PTR(ret);
+	}
+
+	sg_set_page(table->sgl, pfn_to_page(__phys_to_pfn(info->phys)),
+		    buffer->size, 0);
+	table->sgl->dma_address = info->phys;
+
+	return table;
+}
+
+static void ion_cma_heap_unmap_dma(struct ion_heap *heap,
+				   struct ion_buffer *buffer)
+{
+	if (buffer->sg_table)
+		sg_free_table(buffer->sg_table);
+	kfree(buffer->sg_table);
+	buffer->sg_table = NULL;
+}
+
+static void *ion_cma_heap_map_kernel(struct ion_heap *heap,
+				     struct ion_buffer *buffer)
+{
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+
+	return info->cpu_addr;
+}
+
+static void ion_cma_heap_unmap_kernel(struct ion_heap *heap,
+				      struct ion_buffer *buffer)
+{
+}
+
+static int ion_cma_heap_map_user(struct ion_heap *heap,
+				 struct ion_buffer *buffer,
+				 struct vm_area_struct *vma)
+{
+	struct ion_cma_heap *cma_heap = to_cma_heap(heap);
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+
+	if (!ION_IS_CACHED(buffer->flags))
+		return dma_mmap_writecombine(cma_heap->dev, vma, info->cpu_addr,
+					     info->handle, buffer->size);
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       __phys_to_pfn(info->phys) + vma->vm_pgoff,
+			       vma->vm_end - vma->vm_start,
+			       vma->vm_page_prot);
+}
+
+static int ion_cma_heap_cache_ops(struct ion_heap *heap,
+				  struct ion_buffer *buffer, void *vaddr,
+				  unsigned int offset, unsigned int length,
+				  unsigned int cmd)
+{
+	struct ion_cma_heap *cma_heap = to_cma_heap(heap);
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+	void (*outer_cache_op)(phys_addr_t, phys_addr_t);
+
+	switch (cmd) {
+	case ION_IOC_CLEAN_CACHES:
+		dmac_clean_range(vaddr, vaddr + length);
+		outer_cache_op = outer_clean_range;
+		break;
+	case ION_IOC_INV_CACHES:
+		dmac_inv_range(vaddr, vaddr + length);
+		outer_cache_op = outer_inv_range;
+		break;
+	case ION_IOC_CLEAN_INV_CACHES:
+		dmac_flush_range(vaddr, vaddr + length);
+		outer_cache_op = outer_flush_range;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (cma_heap->has_outer_cache) {
+		unsigned long pstart = info->phys + offset;
+		outer_cache_op(pstart, pstart + length);
+	}
+	return 0;
+}
+
+static int ion_cma_heap_print_debug(struct ion_heap *heap, struct seq_file *s,
+				    const struct rb_root *unused)
+{
+	struct ion_cma_heap *cma_heap = to_cma_heap(heap);
+
+	seq_printf(s, "total bytes currently allocated: %lx\n",
+		(unsigned long)atomic_read(&cma_heap->allocated_bytes));
+	seq_printf(s, "migration statistics: /sys/kernel/debug/cma\n");
+
+	return 0;
+}
+
+static int ion_cma_heap_map_iommu(struct ion_buffer *buffer,
+				  struct ion_iommu_map *data,
+				  unsigned int domain_num,
+				  unsigned int partition_num,
+				  unsigned long align,
+				  unsigned long iova_length,
+				  unsigned long flags)
+{
+	struct ion_cma_buffer_info *info = buffer->priv_virt;
+	struct iommu_domain *domain;
+	struct scatterlist *sglist;
+	unsigned long extra;
+	int prot = IOMMU_WRITE | IOMMU_READ;
+	int ret;
+
+	prot |= ION_IS_CACHED(flags) ? IOMMU_CACHE : 0;
+	data->mapped_size = iova_length;
+
+	if (!msm_use_iommu()) {
+		data->iova_addr = info->phys;
+		return 0;
+	}
+
+	extra = iova_length - buffer->size;
+
+	ret = msm_allocate_iova_address(domain_num, partition_num,
+					data->mapped_size, align,
+					&data->iova_addr);
+	if (ret)
+		return ret;
+
+	domain = msm_get_iommu_domain(domain_num);
+	if (!domain) {
+		ret = -ENOMEM;
+		goto out_free_iova;
+	}
+
+	sglist = vmalloc(sizeof(*sglist));
+	if (!sglist) {
+		ret = -ENOMEM;
+		goto out_free_iova;
+	}
+
+	sg_init_table(sglist, 1);
+	sglist->length = buffer->size;
+	sglist->offset = 0;
+	sglist->dma_address = info->phys;
+
+	ret = iommu_map_range(domain, data->iova_addr, sglist,
+			      buffer->size, prot);
+	vfree(sglist);
+	if (ret) {
+		pr_err("%s: could not map %lx in domain %p\n",
+			__func__, data->iova_addr, domain);
+		goto out_free_iova;
+	}
+
+	if (extra) {
+		unsigned long extra_iova_addr = data->iova_addr + buffer->size;
+		ret = msm_iommu_map_extra(domain, extra_iova_addr, extra,
+					  SZ_4K, prot);
+		if (ret)
+			goto out_unmap;
+	}
+	return 0;
+
+out_unmap:
+	iommu_unmap_range(domain, data->iova_addr, buffer->size);
+out_free_iova:
+	msm_free_iova_address(data->iova_addr, domain_num, partition_num,
+			      data->mapped_size);
+	return ret;
+}
+
+static void ion_cma_heap_unmap_iommu(struct ion_iommu_map *data)
+{
+	unsigned int domain_num;
+	unsigned int partition_num;
+	struct iommu_domain *domain;
+
+	if (!msm_use_iommu())
+		return;
+
+	domain_num = iommu_map_domain(data);
+	partition_num = iommu_map_partition(data);
+
+	domain = msm_get_iommu_domain(domain_num);
+	if (!domain) {
+		WARN(1, "Could not get domain %d. Corruption?\n", domain_num);
+		return;
+	}
+
+	iommu_unmap_range(domain, data->iova_addr, data->mapped_size);
+	msm_free_iova_address(data->iova_addr, domain_num, partition_num,
+			      data->mapped_size);
+}
+
+static struct ion_heap_ops cma_heap_ops = {
+	.allocate = ion_cma_heap_allocate,
+	.free = ion_cma_heap_free,
+	.phys = ion_cma_heap_phys,
+	.map_dma = ion_cma_heap_map_dma,
+	.unmap_dma = ion_cma_heap_unmap_dma,
+	.map_kernel = ion_cma_heap_map_kernel,
+	.unmap_kernel = ion_cma_heap_unmap_kernel,
+	.map_user = ion_cma_heap_map_user,
+	.cache_op = ion_cma_heap_cache_ops,
+	.print_debug = ion_cma_heap_print_debug,
+	.map_iommu = ion_cma_heap_map_iommu,
+	.unmap_iommu = ion_cma_heap_unmap_iommu,
+};
+
+struct ion_heap *ion_cma_heap_create(struct ion_platform_heap *heap_data)
+{
+	struct ion_cma_heap_pdata *pdata = heap_data->extra_data;
+	struct ion_cma_heap *cma_heap;
+
+	if (!pdata || !pdata->dev) {
+		pr_err("%s: heap %s has no device\n", __func__,
+		       heap_data->name);
+		return ERR_PTR(-EINVAL);
+	}
+
+	cma_heap = kzalloc(sizeof(struct ion_cma_heap), GFP_KERNEL);
+	if (!cma_heap)
+		return ERR_PTR(-ENOMEM);
+
+	cma_heap->heap.ops = &cma_heap_ops;
+	cma_heap->heap.type = ION_HEAP_TYPE_CMA;
+	cma_heap->dev = pdata->dev;
+	cma_heap->has_outer_cache = heap_data->has_outer_cache;
+	atomic_set(&cma_heap->allocated_bytes, 0);
+
+	return &cma_heap->heap;
+}
+
+void ion_cma_heap_destroy(struct ion_heap *heap)
+{
+	kfree(to_cma_heap(heap));
+}
@@ -16,9 +16,149 @@
  */
 
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
 #include "ion_priv.h"
 
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	spin_lock(&heap->free_lock);
+	list_add_tail(&buffer->list, &heap->free_list);
+	heap->free_list_size += buffer->size;
+	spin_unlock(&heap->free_lock);
+	wake_up(&heap->waitqueue);
+}
+
+size_t ion_heap_freelist_size(struct ion_heap *heap)
+{
+	size_t size;
+
+	spin_lock(&heap->free_lock);
+	size = heap->free_list_size;
+	spin_unlock(&heap->free_lock);
+
+	return size;
+}
+
+/*
+ * Free queued buffers, oldest first, until at least size bytes have been
+ * released or the list is empty; size == 0 frees everything.  Called from
+ * the shrinker, possibly with IOMMU or other driver locks held further up
+ * the stack, so buffers that still need their IOMMU mappings torn down
+ * are left for the free thread.
+ */
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size)
+{
+	struct ion_buffer *buffer, *tmp;
+	size_t freed = 0;
+
+	spin_lock(&heap->free_lock);
+	while (!size || freed < size) {
+		buffer = NULL;
+		list_for_each_entry(tmp, &heap->free_list, list) {
+			if (RB_EMPTY_ROOT(&tmp->iommu_maps)) {
+				buffer = tmp;
+				break;
+			}
+		}
+		if (!buffer)
+			break;
+		list_del(&buffer->list);
+		heap->free_list_size -= buffer->size;
+		freed += buffer->size;
+		spin_unlock(&heap->free_lock);
+
+		buffer->private_flags |= ION_PRIV_FLAG_SHRINKER_FREE;
+		ion_buffer_destroy(buffer);
+
+		spin_lock(&heap->free_lock);
+	}
+	spin_unlock(&heap->free_lock);
+
+	return freed;
+}
+
+static int ion_heap_deferred_free(void *data)
+{
+	struct ion_heap *heap = data;
+
+	set_user_nice(current, 19);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		struct list_head batch;
+		struct ion_buffer *buffer, *tmp;
+
+		wait_event_freezable(heap->waitqueue,
+				     ion_heap_freelist_size(heap) > 0 ||
+				     kthread_should_stop());
+
+		INIT_LIST_HEAD(&batch);
+		spin_lock(&heap->free_lock);
+		list_splice_init(&heap->free_list, &batch);
+		spin_unlock(&heap->free_lock);
+
+		list_for_each_entry_safe(buffer, tmp, &batch, list) {
+			list_del(&buffer->list);
+			spin_lock(&heap->free_lock);
+			heap->free_list_size -= buffer->size;
+			spin_unlock(&heap->free_lock);
+			ion_buffer_destroy(buffer);
+		}
+	}
+
+	return 0;
+}
+
+static int ion_heap_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct ion_heap *heap = container_of(shrinker, struct ion_heap,
+					     shrinker);
+
+	if (sc->nr_to_scan)
+		ion_heap_freelist_drain(heap, sc->nr_to_scan * PAGE_SIZE);
+
+	return ion_heap_freelist_size(heap) / PAGE_SIZE;
+}
+
+int ion_heap_init_deferred_free(struct ion_heap *heap)
+{
+	INIT_LIST_HEAD(&heap->free_list);
+	heap->free_list_size = 0;
+	spin_lock_init(&heap->free_lock);
+	init_waitqueue_head(&heap->waitqueue);
+
+	heap->task = kthread_run(ion_heap_deferred_free, heap, "ion_free_%s",
+				 heap->name);
+	if (IS_ERR(heap->task)) {
+		pr_err("%s: creating thread for deferred free failed\n",
+		       __func__);
+		return PTR_ERR(heap->task);
+	}
+
+	heap->shrinker.shrink = ion_heap_shrink;
+	heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&heap->shrinker);
+	return 0;
+}
+
+static void ion_heap_stop_deferred_free(struct ion_heap *heap)
+{
+	struct ion_buffer *buffer, *tmp;
+
+	unregister_shrinker(&heap->shrinker);
+	kthread_stop(heap->task);
+
+	list_for_each_entry_safe(buffer, tmp, &heap->free_list, list) {
+		list_del(&buffer->list);
+		heap->free_list_size -= buffer->size;
+		ion_buffer_destroy(buffer);
+	}
+}
+
 struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 {
 	struct ion_heap *heap = NULL;
@@ -39,6 +179,11 @@ struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 	case ION_HEAP_TYPE_CP:
 		heap = ion_cp_heap_create(heap_data);
 		break;
+#ifdef CONFIG_ION_CMA
+	case ION_HEAP_TYPE_CMA:
+		heap = ion_cma_heap_create(heap_data);
+		break;
+#endif
 	default:
 		pr_err("%s: Invalid heap type %d\n", __func__,
 		       heap_data->type);
@@ -62,6 +207,9 @@ void ion_heap_destroy(struct ion_heap *heap)
 	if (!heap)
 		return;
 
+	if (heap->flags & ION_HEAP_FLAG_DEFER_FREE)
+		ion_heap_stop_deferred_free(heap);
+
 	switch (heap->type) {
 	case ION_HEAP_TYPE_SYSTEM_CONTIG:
 		ion_system_contig_heap_destroy(heap);
@@ -78,6 +226,11 @@ void ion_heap_destroy(struct ion_heap *heap)
 	case ION_HEAP_TYPE_CP:
 		ion_cp_heap_destroy(heap);
 		break;
+#ifdef CONFIG_ION_CMA
+	case ION_HEAP_TYPE_CMA:
+		ion_cma_heap_destroy(heap);
+		break;
+#endif
 	default:
 		pr_err("%s: Invalid heap type %d\n", __func__,
 		       heap->type);
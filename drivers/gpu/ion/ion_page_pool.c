@@ -0,0 +1,165 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
+#include "ion_priv.h"
+
+/*
+ * Every page handed out by a pool is zeroed and has no dirty lines left in
+ * the inner or outer cache, so it can go to a device or to userspace as is.
+ * Freshly allocated pages only need the flush; returned pages are zeroed
+ * and flushed before they go back on the list.
+ */
+static void ion_page_pool_clean(struct ion_page_pool *pool, struct page *page,
+				bool zero)
+{
+	unsigned long i;
+
+	for (i = 0; i < (1 << pool->order); i++) {
+		void *addr = kmap_atomic(page + i);
+
+		if (zero)
+			memset(addr, 0, PAGE_SIZE);
+		dmac_flush_range(addr, addr + PAGE_SIZE);
+		kunmap_atomic(addr);
+	}
+
+	if (pool->has_outer_cache) {
+		phys_addr_t pstart = page_to_phys(page);
+
+		outer_flush_range(pstart, pstart + (PAGE_SIZE << pool->order));
+	}
+}
+
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool)
+{
+	struct page *page = alloc_pages(pool->gfp_mask | __GFP_ZERO,
+					pool->order);
+
+	if (!page)
+		return NULL;
+	/*
+	 * Split high order blocks so that every page carries its own
+	 * reference and can be inserted into user mappings; the block is
+	 * still kept and handed out as one chunk.
+	 */
+	if (pool->order)
+		split_page(page, pool->order);
+	ion_page_pool_clean(pool, page, false);
+	return page;
+}
+
+static void ion_page_pool_free_pages(struct ion_page_pool *pool,
+				     struct page *page)
+{
+	unsigned long i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		__free_page(page + i);
+}
+
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	mutex_lock(&pool->mutex);
+	if (pool->count) {
+		page = list_first_entry(&pool->items, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	mutex_unlock(&pool->mutex);
+
+	if (!page)
+		page = ion_page_pool_alloc_pages(pool);
+	return page;
+}
+
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	ion_page_pool_clean(pool, page, true);
+
+	mutex_lock(&pool->mutex);
+	list_add(&page->lru, &pool->items);
+	pool->count++;
+	mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Give up to nr_to_scan pages (not chunks) back to the page allocator,
+ * oldest first.  With nr_to_scan == 0 only report how many pages the pool
+ * holds.  Returns the number of pages freed or held.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan)
+{
+	int freed = 0;
+
+	if (!nr_to_scan)
+		return pool->count << pool->order;
+
+	while (freed < nr_to_scan) {
+		struct page *page;
+
+		mutex_lock(&pool->mutex);
+		if (!pool->count) {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		page = list_entry(pool->items.prev, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		mutex_unlock(&pool->mutex);
+
+		ion_page_pool_free_pages(pool, page);
+		freed += (1 << pool->order);
+	}
+
+	return freed;
+}
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool has_outer_cache)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(struct ion_page_pool),
+					     GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->items);
+	mutex_init(&pool->mutex);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	pool->has_outer_cache = has_outer_cache;
+	return pool;
+}
+
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	struct page *page, *tmp;
+
+	list_for_each_entry_safe(page, tmp, &pool->items, lru) {
+		list_del(&page->lru);
+		ion_page_pool_free_pages(pool, page);
+	}
+	kfree(pool);
+}
@@ -22,6 +22,10 @@
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/sched.h>
+#include <linux/shrinker.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/ion.h>
 #include <linux/iommu.h>
 #include <linux/seq_file.h>
@@ -47,9 +51,14 @@ struct ion_iommu_map {
 
 struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
 
+/* Set on buffers freed by the deferred free shrinker: skip page pools */
+#define ION_PRIV_FLAG_SHRINKER_FREE	(1 << 0)
+
 struct ion_buffer {
 	struct kref ref;
 	struct rb_node node;
+	struct list_head list;
+	unsigned long private_flags;
 	struct ion_device *dev;
 	struct ion_heap *heap;
 	struct ion_client *creator;
@@ -102,6 +111,23 @@ struct ion_heap_ops {
 	int (*unsecure_heap)(struct ion_heap *heap, int version, void *data);
 };
 
+/*
+ * Buffers of heaps with ION_HEAP_FLAG_DEFER_FREE set are not torn down by
+ * whoever drops the last reference; they are queued on the heap's free
+ * list and freed by a low priority kernel thread instead.
+ */
+#define ION_HEAP_FLAG_DEFER_FREE	(1 << 0)
+
+/**
+ * struct ion_heap - represents a heap in the system
+ * @flags:		ION_HEAP_FLAG_* set by the heap's create function
+ * @free_list:		buffers waiting to be freed (deferred free only)
+ * @free_list_size:	total size of the buffers on @free_list
+ * @free_lock:		protects @free_list and @free_list_size
+ * @waitqueue:		the free thread waits here for buffers
+ * @task:		the free thread
+ * @shrinker:		drains @free_list under memory pressure
+ */
 struct ion_heap {
 	struct rb_node node;
 	struct ion_device *dev;
@@ -109,6 +135,13 @@ struct ion_heap {
 	struct ion_heap_ops *ops;
 	int id;
 	const char *name;
+	unsigned long flags;
+	struct list_head free_list;
+	size_t free_list_size;
+	spinlock_t free_lock;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
+	struct shrinker shrinker;
 };
 
 struct mem_map_data {
@@ -136,6 +169,13 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
 void ion_heap_destroy(struct ion_heap *);
 
+void ion_buffer_destroy(struct ion_buffer *buffer);
+
+int ion_heap_init_deferred_free(struct ion_heap *heap);
+void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+size_t ion_heap_freelist_drain(struct ion_heap *heap, size_t size);
+size_t ion_heap_freelist_size(struct ion_heap *heap);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *);
 void ion_system_heap_destroy(struct ion_heap *);
 
@@ -151,9 +191,45 @@ void ion_iommu_heap_destroy(struct ion_heap *);
 struct ion_heap *ion_cp_heap_create(struct ion_platform_heap *);
 void ion_cp_heap_destroy(struct ion_heap *);
 
+struct ion_heap *ion_cma_heap_create(struct ion_platform_heap *);
+void ion_cma_heap_destroy(struct ion_heap *);
+
 struct ion_heap *ion_reusable_heap_create(struct ion_platform_heap *);
 void ion_reusable_heap_destroy(struct ion_heap *);
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @count:		number of chunks in the pool
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that went to the page allocator
+ * @items:		list of free chunks, most recently freed first
+ * @mutex:		protects the list and counters
+ * @gfp_mask:		gfp_mask used to allocate new chunks
+ * @order:		order of the chunks in this pool
+ * @has_outer_cache:	flush the outer cache when cleaning chunks
+ *
+ * Keeps freed chunks of one order zeroed and cache-clean for reuse.  The
+ * pool never shrinks on its own, its owner calls ion_page_pool_shrink()
+ * from a shrinker.
+ */
+struct ion_page_pool {
+	int count;
+	unsigned long hits;
+	unsigned long misses;
+	struct list_head items;
+	struct mutex mutex;
+	gfp_t gfp_mask;
+	unsigned int order;
+	bool has_outer_cache;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool has_outer_cache);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_shrink(struct ion_page_pool *pool, int nr_to_scan);
+
 ion_phys_addr_t ion_carveout_allocate(struct ion_heap *heap, unsigned long size,
 				      unsigned long align);
 void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
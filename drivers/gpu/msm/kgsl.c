@@ -34,6 +34,7 @@
 #include "kgsl_cffdump.h"
 #include "kgsl_log.h"
 #include "kgsl_sharedmem.h"
+#include "kgsl_pool.h"
 #include "kgsl_device.h"
 #include "kgsl_trace.h"
 #include "kgsl_sync.h"
@@ -2499,6 +2500,7 @@ static void kgsl_core_exit(void)
 
 	kgsl_drm_exit();
 	kgsl_cffdump_destroy();
+	kgsl_pool_exit();
 	kgsl_core_debugfs_close();
 
 	if (kgsl_driver.virtdev.class) {
@@ -2564,6 +2566,7 @@ static int __init kgsl_core_init(void)
 				       &kgsl_driver.virtdev.kobj);
 
 	kgsl_core_debugfs_init();
+	kgsl_pool_init();
 
 	kgsl_sharedmem_init_sysfs();
 	kgsl_sharedmem_init_ion();
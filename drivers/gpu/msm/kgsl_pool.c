@@ -0,0 +1,403 @@
+/* Copyright (c) 2012, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/debugfs.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <asm/cacheflush.h>
+#include <asm/div64.h>
+
+#include "kgsl.h"
+#include "kgsl_debugfs.h"
+#include "kgsl_pool.h"
+
+/*
+ * Pools of zeroed, cache-flushed chunks for GPU buffer allocations, one per
+ * chunk size that _kgsl_sharedmem_page_alloc() asks for.  Freed chunks go on
+ * the dirty list; a worker zeroes and flushes them and tops the clean list
+ * up to the reserve, so that allocations normally only take chunks off a
+ * list.  A shrinker gives everything back under memory pressure.
+ */
+struct kgsl_page_pool {
+	unsigned int order;
+	gfp_t gfp_mask;
+	u32 reserve;
+	u32 max_chunks;
+	spinlock_t lock;
+	struct list_head clean;
+	struct list_head dirty;
+	unsigned int clean_count;
+	unsigned int dirty_count;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+/* Refills run in the background, so they should not push into reclaim */
+#define KGSL_POOL_GFP_LOW	(GFP_KERNEL | __GFP_HIGHMEM | __GFP_NORETRY | \
+				 __GFP_NOWARN)
+#define KGSL_POOL_GFP_HIGH	(__GFP_HIGHMEM | __GFP_COMP | __GFP_NO_COMPACT | \
+				 __GFP_NOWARN | __GFP_NORETRY | __GFP_NO_KSWAPD)
+
+static struct kgsl_page_pool kgsl_pools[] = {
+	{
+		.order = 0,
+		.gfp_mask = KGSL_POOL_GFP_LOW,
+		.reserve = 256,
+		.max_chunks = 1024,
+	},
+	{
+		.order = 4,
+		.gfp_mask = KGSL_POOL_GFP_HIGH,
+		.reserve = 16,
+		.max_chunks = 64,
+	},
+};
+
+static struct {
+	spinlock_t lock;
+	unsigned long count;
+	unsigned long long usecs;
+	unsigned int usecs_max;
+} kgsl_pool_alloc_stats;
+
+/* Do not refill from the page allocator within a second of a shrink */
+static unsigned long kgsl_pool_shrunk;
+static bool kgsl_pool_initialized;
+
+static void kgsl_pool_worker(struct work_struct *work);
+static DECLARE_WORK(kgsl_pool_work, kgsl_pool_worker);
+
+static struct kgsl_page_pool *kgsl_pool_find(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		if (kgsl_pools[i].order == order)
+			return &kgsl_pools[i];
+	return NULL;
+}
+
+void kgsl_pool_clean_page(struct page *page, unsigned int order)
+{
+	phys_addr_t phys = page_to_phys(page);
+	int i;
+
+	for (i = 0; i < (1 << order); i++) {
+		void *ptr = kmap_atomic(nth_page(page, i));
+
+		memset(ptr, 0, PAGE_SIZE);
+		dmac_flush_range(ptr, ptr + PAGE_SIZE);
+		kunmap_atomic(ptr);
+	}
+
+	outer_flush_range(phys, phys + (PAGE_SIZE << order));
+}
+
+/* Take a chunk off one of the lists, with the pool lock held */
+static struct page *_kgsl_pool_take(struct list_head *list,
+				    unsigned int *count)
+{
+	struct page *page;
+
+	if (list_empty(list))
+		return NULL;
+
+	page = list_first_entry(list, struct page, lru);
+	list_del(&page->lru);
+	(*count)--;
+	return page;
+}
+
+static void kgsl_pool_add_clean(struct kgsl_page_pool *pool,
+				struct page *page)
+{
+	spin_lock(&pool->lock);
+	list_add_tail(&page->lru, &pool->clean);
+	pool->clean_count++;
+	spin_unlock(&pool->lock);
+}
+
+static void kgsl_pool_worker(struct work_struct *work)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		struct page *page;
+
+		for (;;) {
+			spin_lock(&pool->lock);
+			page = _kgsl_pool_take(&pool->dirty,
+					       &pool->dirty_count);
+			spin_unlock(&pool->lock);
+			if (page == NULL)
+				break;
+			kgsl_pool_clean_page(page, pool->order);
+			kgsl_pool_add_clean(pool, page);
+		}
+
+		if (time_before(jiffies, kgsl_pool_shrunk + HZ))
+			continue;
+
+		while (pool->clean_count < pool->reserve) {
+			page = alloc_pages(pool->gfp_mask, pool->order);
+			if (page == NULL)
+				break;
+			kgsl_pool_clean_page(page, pool->order);
+			kgsl_pool_add_clean(pool, page);
+		}
+	}
+}
+
+/*
+ * Return a zeroed chunk of 1 << order pages with no dirty cache lines,
+ * from the pool if it has one, otherwise freshly allocated with gfp_mask.
+ */
+struct page *kgsl_pool_alloc_page(unsigned int order, gfp_t gfp_mask)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+	struct page *page = NULL;
+	bool dirty = false;
+	bool refill = false;
+
+	if (pool) {
+		spin_lock(&pool->lock);
+		page = _kgsl_pool_take(&pool->clean, &pool->clean_count);
+		if (page == NULL) {
+			page = _kgsl_pool_take(&pool->dirty,
+					       &pool->dirty_count);
+			dirty = true;
+		}
+		if (page)
+			pool->hits++;
+		else
+			pool->misses++;
+		refill = pool->clean_count < pool->reserve;
+		spin_unlock(&pool->lock);
+
+		if (refill)
+			queue_work(system_unbound_wq, &kgsl_pool_work);
+	}
+
+	if (page == NULL) {
+		page = alloc_pages(gfp_mask, order);
+		dirty = true;
+	}
+
+	if (page && dirty)
+		kgsl_pool_clean_page(page, order);
+
+	return page;
+}
+
+void kgsl_pool_free_page(struct page *page, unsigned int order)
+{
+	struct kgsl_page_pool *pool = kgsl_pool_find(order);
+
+	/* pages still mapped somewhere are left to the page allocator */
+	if (pool && page_count(page) == 1) {
+		bool queued = false;
+
+		spin_lock(&pool->lock);
+		if (pool->clean_count + pool->dirty_count < pool->max_chunks) {
+			list_add_tail(&page->lru, &pool->dirty);
+			pool->dirty_count++;
+			queued = true;
+		}
+		spin_unlock(&pool->lock);
+
+		if (queued) {
+			queue_work(system_unbound_wq, &kgsl_pool_work);
+			return;
+		}
+	}
+
+	__free_pages(page, order);
+}
+
+void kgsl_pool_account_alloc(unsigned int usecs)
+{
+	spin_lock(&kgsl_pool_alloc_stats.lock);
+	kgsl_pool_alloc_stats.count++;
+	kgsl_pool_alloc_stats.usecs += usecs;
+	if (usecs > kgsl_pool_alloc_stats.usecs_max)
+		kgsl_pool_alloc_stats.usecs_max = usecs;
+	spin_unlock(&kgsl_pool_alloc_stats.lock);
+}
+
+static int kgsl_pool_total_pages(void)
+{
+	int i, total = 0;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++)
+		total += (kgsl_pools[i].clean_count +
+			  kgsl_pools[i].dirty_count) << kgsl_pools[i].order;
+	return total;
+}
+
+static int kgsl_pool_shrink(struct shrinker *shrinker,
+			    struct shrink_control *sc)
+{
+	int nr_to_scan = sc->nr_to_scan;
+	int i;
+
+	if (nr_to_scan)
+		kgsl_pool_shrunk = jiffies;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools) && nr_to_scan > 0; i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		while (nr_to_scan > 0) {
+			struct page *page;
+
+			spin_lock(&pool->lock);
+			page = _kgsl_pool_take(&pool->dirty,
+					       &pool->dirty_count);
+			if (page == NULL)
+				page = _kgsl_pool_take(&pool->clean,
+						       &pool->clean_count);
+			spin_unlock(&pool->lock);
+			if (page == NULL)
+				break;
+
+			__free_pages(page, pool->order);
+			nr_to_scan -= 1 << pool->order;
+		}
+	}
+
+	return kgsl_pool_total_pages();
+}
+
+static struct shrinker kgsl_pool_shrinker = {
+	.shrink = kgsl_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+#ifdef CONFIG_DEBUG_FS
+static int kgsl_pool_stats_show(struct seq_file *s, void *unused)
+{
+	unsigned long count;
+	unsigned long long usecs;
+	unsigned int usecs_max;
+	int i;
+
+	seq_printf(s, "%5s %8s %8s %8s %8s %10s %10s\n", "order", "clean",
+		   "dirty", "reserve", "max", "hits", "misses");
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+
+		spin_lock(&pool->lock);
+		seq_printf(s, "%5u %8u %8u %8u %8u %10lu %10lu\n",
+			   pool->order, pool->clean_count, pool->dirty_count,
+			   pool->reserve, pool->max_chunks, pool->hits,
+			   pool->misses);
+		spin_unlock(&pool->lock);
+	}
+
+	spin_lock(&kgsl_pool_alloc_stats.lock);
+	count = kgsl_pool_alloc_stats.count;
+	usecs = kgsl_pool_alloc_stats.usecs;
+	usecs_max = kgsl_pool_alloc_stats.usecs_max;
+	spin_unlock(&kgsl_pool_alloc_stats.lock);
+
+	if (count)
+		do_div(usecs, count);
+	seq_printf(s, "allocations: %lu, avg %llu us, max %u us\n", count,
+		   usecs, usecs_max);
+	return 0;
+}
+
+static int kgsl_pool_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kgsl_pool_stats_show, NULL);
+}
+
+static const struct file_operations kgsl_pool_stats_fops = {
+	.open = kgsl_pool_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void kgsl_pool_debugfs_init(void)
+{
+	struct dentry *parent = kgsl_get_debugfs_dir();
+	struct dentry *dir;
+	char name[24];
+	int i;
+
+	if (IS_ERR_OR_NULL(parent))
+		return;
+
+	dir = debugfs_create_dir("pool", parent);
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_file("stats", 0444, dir, NULL, &kgsl_pool_stats_fops);
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		snprintf(name, sizeof(name), "order%u_reserve",
+			 kgsl_pools[i].order);
+		debugfs_create_u32(name, 0644, dir, &kgsl_pools[i].reserve);
+		snprintf(name, sizeof(name), "order%u_max",
+			 kgsl_pools[i].order);
+		debugfs_create_u32(name, 0644, dir, &kgsl_pools[i].max_chunks);
+	}
+}
+#else
+static inline void kgsl_pool_debugfs_init(void) { }
+#endif
+
+void kgsl_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		spin_lock_init(&kgsl_pools[i].lock);
+		INIT_LIST_HEAD(&kgsl_pools[i].clean);
+		INIT_LIST_HEAD(&kgsl_pools[i].dirty);
+	}
+	spin_lock_init(&kgsl_pool_alloc_stats.lock);
+
+	register_shrinker(&kgsl_pool_shrinker);
+	kgsl_pool_debugfs_init();
+	kgsl_pool_initialized = true;
+	queue_work(system_unbound_wq, &kgsl_pool_work);
+}
+
+void kgsl_pool_exit(void)
+{
+	int i;
+
+	if (!kgsl_pool_initialized)
+		return;
+	kgsl_pool_initialized = false;
+
+	unregister_shrinker(&kgsl_pool_shrinker);
+	cancel_work_sync(&kgsl_pool_work);
+
+	for (i = 0; i < ARRAY_SIZE(kgsl_pools); i++) {
+		struct kgsl_page_pool *pool = &kgsl_pools[i];
+		struct page *page;
+
+		while ((page = _kgsl_pool_take(&pool->dirty,
+					       &pool->dirty_count)))
+			__free_pages(page, pool->order);
+		while ((page = _kgsl_pool_take(&pool->clean,
+					       &pool->clean_count)))
+			__free_pages(page, pool->order);
+	}
+}
@@ -0,0 +1,28 @@
+/* Copyright (c) 2012, The Linux Foundation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef __KGSL_POOL_H
+#define __KGSL_POOL_H
+
+#include <linux/gfp.h>
+
+struct page;
+
+struct page *kgsl_pool_alloc_page(unsigned int order, gfp_t gfp_mask);
+void kgsl_pool_free_page(struct page *page, unsigned int order);
+void kgsl_pool_clean_page(struct page *page, unsigned int order);
+void kgsl_pool_account_alloc(unsigned int usecs);
+
+void kgsl_pool_init(void);
+void kgsl_pool_exit(void);
+
+#endif /* __KGSL_POOL_H */
@@ -64,6 +64,9 @@ MODULE_ALIAS("mmc:block");
 			(rq_data_dir(req) == WRITE))
 #define PACKED_CMD_VER		0x01
 #define PACKED_CMD_WR		0x02
+#define MMC_PACK_MIN_SAMPLES	8
+#define MMC_PACK_THRESH_MIN	2
+#define MMC_PACK_THRESH_MAX	64
 #define MMC_BLK_UPDATE_STOP_REASON(stats, reason)			\
 	do {								\
 		if (stats->enabled)					\
@@ -313,8 +316,10 @@ num_wr_reqs_to_start_packing_store(struct device *dev,
 	struct mmc_blk_data *md = mmc_blk_get(dev_to_disk(dev));
 
 	sscanf(buf, "%d", &value);
-	if (value >= 0)
+	if (value >= 0) {
 		md->queue.num_wr_reqs_to_start_packing = value;
+		md->queue.card->pack_policy.adaptive = 0;
+	}
 
 	mmc_blk_put(md);
 	return count;
@@ -1002,6 +1007,73 @@ out:
 	return err ? 0 : 1;
 }
 
+static bool mmc_blk_discard_overlaps(struct mmc_queue *mq,
+				     struct request *req)
+{
+	struct request *prq;
+
+	list_for_each_entry(prq, &mq->held_discards, queuelist)
+		if (blk_rq_pos(req) < blk_rq_pos(prq) + blk_rq_sectors(prq) &&
+		    blk_rq_pos(prq) < blk_rq_pos(req) + blk_rq_sectors(req))
+			return true;
+	return false;
+}
+
+/*
+ * A discard is held back while other requests are waiting, so that it
+ * does not keep the card busy in front of them, and issued together
+ * with the others held once the queue runs empty, see
+ * mmc_blk_flush_discards().
+ */
+static bool mmc_blk_hold_discard(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_idle_bkops *ib = &mq->card->idle_bkops;
+	struct request_queue *q = mq->queue;
+	bool busy;
+
+	if (!ib->discard_batch || mq->nr_held_discards >= ib->discard_batch)
+		return false;
+
+	spin_lock_irq(q->queue_lock);
+	busy = blk_peek_request(q) != NULL;
+	spin_unlock_irq(q->queue_lock);
+	if (!busy)
+		return false;
+
+	if (!mq->nr_held_discards)
+		mq->held_since = jiffies;
+	list_add_tail(&req->queuelist, &mq->held_discards);
+	mq->nr_held_discards++;
+
+	spin_lock_irq(&ib->lock);
+	ib->discards_held++;
+	spin_unlock_irq(&ib->lock);
+	return true;
+}
+
+/*
+ * Held discards have to go out before anything that might depend on
+ * them: a flush, a secure discard or sanitize, or I/O to the same
+ * sectors.  They are also not held longer than discard_max_delay_ms.
+ */
+static bool mmc_blk_must_flush_discards(struct mmc_queue *mq,
+					struct request *req)
+{
+	struct mmc_idle_bkops *ib = &mq->card->idle_bkops;
+
+	if (!mq->nr_held_discards)
+		return false;
+	if (!req || mq->nr_held_discards >= ib->discard_batch)
+		return true;
+	if (req->cmd_flags & (REQ_FLUSH | REQ_SANITIZE | REQ_SECURE))
+		return true;
+	if (time_after(jiffies, mq->held_since +
+		       msecs_to_jiffies(ib->discard_max_delay_ms)))
+		return true;
+	return !(req->cmd_flags & REQ_DISCARD) &&
+		mmc_blk_discard_overlaps(mq, req);
+}
+
 static int mmc_blk_issue_secdiscard_rq(struct mmc_queue *mq,
 				       struct request *req)
 {
@@ -1389,6 +1461,41 @@ static int mmc_blk_packed_err_check(struct mmc_card *card,
 	return check;
 }
 
+/*
+ * A write that was prepared while the previous request was running is
+ * held back if an urgent request came in meanwhile and is the one the
+ * elevator hands out next, see mmc_blk_requeue_preempted().  An
+ * elevator may keep serving writes with urgent requests queued, ROW
+ * during a write batch for one, and then there is nothing to win.
+ */
+static bool mmc_blk_urgent_defer(struct mmc_card *card,
+				 struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+						   mmc_active);
+	struct request *req = mq_rq->req;
+	struct request *next;
+	struct mmc_queue *mq;
+	bool urgent;
+
+	if (!req || rq_data_dir(req) != WRITE || (req->cmd_flags & REQ_URGENT))
+		return false;
+
+	mq = req->q->queuedata;
+	if (!mq || !ACCESS_ONCE(mq->urgent_pending))
+		return false;
+
+	spin_lock_irq(req->q->queue_lock);
+	next = blk_peek_request(req->q);
+	urgent = next && (next->cmd_flags & REQ_URGENT);
+	spin_unlock_irq(req->q->queue_lock);
+	if (!urgent)
+		return false;
+
+	mq_rq->preempted = true;
+	return true;
+}
+
 static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 			       struct mmc_card *card,
 			       int disable_multi,
@@ -1492,10 +1599,13 @@ static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 	}
 
 	mqrq->mmc_active.mrq = &brq->mrq;
-	if (mmc_card_sd(card))
+	if (mmc_card_sd(card)) {
 		mqrq->mmc_active.err_check = sd_blk_err_check;
-	else
+		mqrq->mmc_active.should_defer = NULL;
+	} else {
 		mqrq->mmc_active.err_check = mmc_blk_err_check;
+		mqrq->mmc_active.should_defer = mmc_blk_urgent_defer;
+	}
 
 	mmc_queue_bounce_pre(mqrq);
 }
@@ -1621,6 +1731,11 @@ void print_mmc_packing_stats(struct mmc_card *card)
 			mmc_hostname(card->host),
 			card->wr_pack_stats.pack_stop_reason[THRESHOLD]);
 
+	if (card->wr_pack_stats.pack_stop_reason[URGENT_REQUEST])
+		pr_info("%s: %d times: urgent request\n",
+			mmc_hostname(card->host),
+			card->wr_pack_stats.pack_stop_reason[URGENT_REQUEST]);
+
 	spin_unlock(&card->wr_pack_stats.lock);
 }
 EXPORT_SYMBOL(print_mmc_packing_stats);
@@ -1649,8 +1764,13 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		goto no_packed;
 
 	if ((rq_data_dir(cur) == WRITE) &&
-			(card->host->caps2 & MMC_CAP2_PACKED_WR))
+			(card->host->caps2 & MMC_CAP2_PACKED_WR)) {
 		max_packed_rw = card->ext_csd.max_packed_writes;
+		if (card->pack_policy.adaptive &&
+		    card->pack_policy.max_packed)
+			max_packed_rw = min(max_packed_rw,
+					    card->pack_policy.max_packed);
+	}
 
 	if (max_packed_rw == 0)
 		goto no_packed;
@@ -1678,6 +1798,14 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 	spin_lock(&stats->lock);
 
 	while (reqs < max_packed_rw - 1) {
+		if (ACCESS_ONCE(mq->urgent_pending)) {
+			MMC_BLK_UPDATE_STOP_REASON(stats, URGENT_REQUEST);
+			spin_lock_irq(&card->urgent_stats.lock);
+			card->urgent_stats.packs_cut++;
+			spin_unlock_irq(&card->urgent_stats.lock);
+			break;
+		}
+
 		spin_lock_irq(q->queue_lock);
 		next = blk_fetch_request(q);
 		spin_unlock_irq(q->queue_lock);
@@ -1687,7 +1815,9 @@ static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
 		}
 
 		if (next->cmd_flags & REQ_DISCARD ||
-				next->cmd_flags & REQ_FLUSH) {
+				next->cmd_flags & REQ_FLUSH ||
+				(mq->nr_held_discards &&
+				 mmc_blk_discard_overlaps(mq, next))) {
 			MMC_BLK_UPDATE_STOP_REASON(stats, FLUSH_OR_DISCARD);
 			put_back = 1;
 			break;
@@ -1824,6 +1954,7 @@ static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
 		mqrq->mmc_active.err_check = mq->err_check_fn;
 	else
 		mqrq->mmc_active.err_check = mmc_blk_packed_err_check;
+	mqrq->mmc_active.should_defer = mmc_blk_urgent_defer;
 
 	if (mq->packed_test_fn)
 		mq->packed_test_fn(mq->queue, mqrq);
@@ -1891,6 +2022,164 @@ static int mmc_blk_end_packed_req(struct mmc_queue *mq,
 	return ret;
 }
 
+/*
+ * Puts the held back write(s) of mqrq_cur back on the dispatch queue,
+ * behind the request the elevator picks next, which is the urgent one
+ * mmc_blk_urgent_defer() peeked at.
+ * mqrq_cur->req is left set: the host stays claimed until the queue
+ * thread has moved past it, the same as after a discard.
+ */
+static void mmc_blk_requeue_preempted(struct mmc_queue *mq)
+{
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct request_queue *q = mq->queue;
+	struct mmc_card *card = mq->card;
+	struct request *next, *prq;
+
+	spin_lock_irq(q->queue_lock);
+	next = blk_fetch_request(q);
+	if (mqrq->packed_cmd != MMC_PACKED_NONE) {
+		while (!list_empty(&mqrq->packed_list)) {
+			prq = list_entry_rq(mqrq->packed_list.prev);
+			list_del_init(&prq->queuelist);
+			blk_requeue_request(q, prq);
+		}
+	} else {
+		blk_requeue_request(q, mqrq->req);
+	}
+	if (next)
+		blk_requeue_request(q, next);
+	spin_unlock_irq(q->queue_lock);
+
+	mmc_blk_clear_packed(mqrq);
+	mqrq->preempted = false;
+
+	spin_lock_irq(&card->urgent_stats.lock);
+	card->urgent_stats.preempted++;
+	spin_unlock_irq(&card->urgent_stats.lock);
+}
+
+static void mmc_blk_urgent_done(struct mmc_card *card,
+				struct mmc_queue_req *mq_rq)
+{
+	struct mmc_urgent_stats *stats = &card->urgent_stats;
+	s64 us = ktime_us_delta(ktime_get(), mq_rq->urgent_start);
+	u32 ms = div_u64(us, USEC_PER_MSEC);
+	int bucket = ms ? min(fls(ms), MMC_URGENT_HIST_BUCKETS - 1) : 0;
+
+	spin_lock_irq(&stats->lock);
+	stats->served++;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+	stats->hist[bucket]++;
+	spin_unlock_irq(&stats->lock);
+
+	mq_rq->urgent_start = ktime_set(0, 0);
+}
+
+static u64 mmc_pack_avg_us(struct mmc_pack_size_stats *s)
+{
+	return div_u64(s->us, s->nr);
+}
+
+/* Bytes per millisecond, so that ratios keep some precision. */
+static u64 mmc_pack_tput(u64 bytes, u64 us)
+{
+	return us ? div64_u64(bytes * USEC_PER_MSEC, us) : 0;
+}
+
+/*
+ * Packing is made to start sooner when packs are clearly faster than
+ * single writes, and later when they hardly are, since packing keeps
+ * reads waiting longer.  The largest pack is limited to what completes
+ * within latency_target_us, and probed one size up while the current
+ * limit completes well within it.  Older samples are then halved.
+ * Called with the policy lock held.
+ */
+static void mmc_blk_pack_adapt(struct mmc_queue *mq,
+			       struct mmc_pack_policy *pp)
+{
+	struct mmc_card *card = mq->card;
+	struct mmc_pack_size_stats *s = pp->size;
+	u8 max_hw = card->ext_csd.max_packed_writes;
+	u64 pbytes = 0, pus = 0, t1, tp;
+	u32 pnr = 0;
+	int thresh = mq->num_wr_reqs_to_start_packing;
+	u8 cap = pp->max_packed;
+	int n;
+
+	for (n = 2; n <= max_hw; n++) {
+		pnr += s[n].nr;
+		pbytes += s[n].bytes;
+		pus += s[n].us;
+	}
+
+	if (s[1].nr >= MMC_PACK_MIN_SAMPLES && pnr >= MMC_PACK_MIN_SAMPLES) {
+		t1 = mmc_pack_tput(s[1].bytes, s[1].us);
+		tp = mmc_pack_tput(pbytes, pus);
+		if (t1 && tp * 100 >= t1 * 125)
+			thresh -= thresh / 4 + 1;
+		else if (t1 && tp * 100 < t1 * 110)
+			thresh += thresh / 2 + 1;
+		thresh = clamp(thresh, MMC_PACK_THRESH_MIN,
+			       MMC_PACK_THRESH_MAX);
+	}
+
+	for (n = 2; n <= cap; n++) {
+		if (s[n].nr >= MMC_PACK_MIN_SAMPLES &&
+		    mmc_pack_avg_us(&s[n]) > pp->latency_target_us) {
+			cap = max(n - 1, 2);
+			break;
+		}
+	}
+	if (cap == pp->max_packed && cap < max_hw &&
+	    s[cap].nr >= MMC_PACK_MIN_SAMPLES &&
+	    mmc_pack_avg_us(&s[cap]) * 4 < pp->latency_target_us * 3)
+		cap++;
+
+	if (thresh != mq->num_wr_reqs_to_start_packing ||
+	    cap != pp->max_packed)
+		pp->adjustments++;
+	mq->num_wr_reqs_to_start_packing = thresh;
+	pp->start_thresh = thresh;
+	pp->max_packed = cap;
+
+	for (n = 1; n <= max_hw; n++) {
+		s[n].nr >>= 1;
+		s[n].bytes >>= 1;
+		s[n].us >>= 1;
+	}
+	pp->completions = 0;
+}
+
+static void mmc_blk_pack_account(struct mmc_queue *mq,
+				 struct mmc_queue_req *mq_rq)
+{
+	struct mmc_pack_policy *pp = &mq->card->pack_policy;
+	struct mmc_pack_size_stats *s;
+	int n = 1;
+
+	if (!pp->size)
+		return;
+	if (mq_rq->packed_cmd != MMC_PACKED_NONE)
+		n = mq_rq->packed_num;
+	if (n > mq->card->ext_csd.max_packed_writes)
+		return;
+
+	spin_lock(&pp->lock);
+	s = &pp->size[n];
+	s->nr++;
+	s->bytes += mq_rq->brq.data.bytes_xfered;
+	s->us += ktime_us_delta(ktime_get(), mq_rq->mmc_active.rq_stime);
+	pp->wr_reqs += n;
+	if (n > 1)
+		pp->packed_reqs += n;
+	if (++pp->completions >= MMC_PACK_ADAPT_INTERVAL && pp->adaptive)
+		mmc_blk_pack_adapt(mq, pp);
+	spin_unlock(&pp->lock);
+}
+
 static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -1939,12 +2228,21 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		case MMC_BLK_PARTIAL:
 			mmc_blk_reset_success(md, type);
 
+			if (status == MMC_BLK_SUCCESS && type == MMC_BLK_WRITE &&
+			    !disable_multi && !retry)
+				mmc_blk_pack_account(mq, mq_rq);
+
 			if (mq_rq->packed_cmd != MMC_PACKED_NONE) {
 				ret = mmc_blk_end_packed_req(mq, mq_rq);
 				break;
 			} else {
+				bool urgent = req->cmd_flags & REQ_URGENT;
+
 				ret = blk_end_request(req, 0,
 						brq->data.bytes_xfered);
+				if (urgent && !ret &&
+				    ktime_to_ns(mq_rq->urgent_start))
+					mmc_blk_urgent_done(card, mq_rq);
 			}
 
 			if (status == MMC_BLK_SUCCESS && ret) {
@@ -2010,6 +2308,9 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		}
 	} while (ret);
 
+	if (mq->mqrq_cur->preempted)
+		mmc_blk_requeue_preempted(mq);
+
 	return 1;
 
  cmd_abort:
@@ -2029,6 +2330,11 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	}
 
  start_new_req:
+	if (mq->mqrq_cur->preempted) {
+		mmc_blk_requeue_preempted(mq);
+		return 0;
+	}
+
 	if (rqc) {
 		if (mq->mqrq_cur->packed_cmd != MMC_PACKED_NONE) {
 			while (!list_empty(&mq->mqrq_cur->packed_list)) {
@@ -2053,6 +2359,26 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	return 0;
 }
 
+static void mmc_blk_flush_discards(struct mmc_queue *mq)
+{
+	struct mmc_idle_bkops *ib = &mq->card->idle_bkops;
+	struct request *prq;
+
+	if (mq->card->host->areq)
+		mmc_blk_issue_rw_rq(mq, NULL);
+
+	while (!list_empty(&mq->held_discards)) {
+		prq = list_entry_rq(mq->held_discards.next);
+		list_del_init(&prq->queuelist);
+		mmc_blk_issue_discard_rq(mq, prq);
+	}
+	mq->nr_held_discards = 0;
+
+	spin_lock_irq(&ib->lock);
+	ib->discard_flushes++;
+	spin_unlock_irq(&ib->lock);
+}
+
 static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 {
 	int ret;
@@ -2076,12 +2402,23 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 		if (req) {
 			blk_end_request_all(req, -EIO);
 		}
+		while (!list_empty(&mq->held_discards)) {
+			struct request *prq = list_entry_rq(
+				mq->held_discards.next);
+
+			list_del_init(&prq->queuelist);
+			blk_end_request_all(prq, -EIO);
+		}
+		mq->nr_held_discards = 0;
 		ret = 0;
 		goto out;
 	}
 
 	mmc_blk_write_packing_control(mq, req);
 
+	if (mmc_blk_must_flush_discards(mq, req))
+		mmc_blk_flush_discards(mq);
+
 	if (req && req->cmd_flags & REQ_SANITIZE) {
 		
 		if (card->host && card->host->areq)
@@ -2093,6 +2430,8 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 			mmc_blk_issue_rw_rq(mq, NULL);
 		if (req->cmd_flags & REQ_SECURE)
 			ret = mmc_blk_issue_secdiscard_rq(mq, req);
+		else if (mmc_blk_hold_discard(mq, req))
+			ret = 1;
 		else
 			ret = mmc_blk_issue_discard_rq(mq, req);
 	} else if (req && req->cmd_flags & REQ_FLUSH) {
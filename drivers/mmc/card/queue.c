@@ -26,6 +26,96 @@
 
 #define DEFAULT_NUM_REQS_TO_START_PACK 17
 
+static void mmc_queue_arm_idle(struct mmc_queue *mq, unsigned long delay)
+{
+	mq->idle_since = jiffies;
+	queue_delayed_work(system_freezable_wq, &mq->idle_work, delay);
+}
+
+/*
+ * Runs once the queue has been idle for idle_bkops.idle_ms, and then
+ * every MMC_IDLE_BKOPS_POLL_MS while the BKOPS it started is running.
+ * Holding thread_sem keeps the queue thread out meanwhile; on new I/O
+ * it takes over and stops BKOPS with HPI.
+ */
+static void mmc_queue_idle_work(struct work_struct *work)
+{
+	struct mmc_queue *mq = container_of(to_delayed_work(work),
+					    struct mmc_queue, idle_work);
+	struct mmc_card *card = mq->card;
+	struct request_queue *q = mq->queue;
+	unsigned long idle = msecs_to_jiffies(card->idle_bkops.idle_ms);
+	unsigned long delay = 0;
+
+	if (!card->idle_bkops.idle_ms)
+		return;
+	if (card->idle_bkops.screen_off_only && !mq->screen_off)
+		return;
+	if (down_trylock(&mq->thread_sem))
+		return;
+
+	if (mq->mqrq_cur->req || mq->mqrq_prev->req ||
+	    q->rq.count[BLK_RW_SYNC] || q->rq.count[BLK_RW_ASYNC])
+		goto out;
+
+	if (time_before(jiffies, mq->idle_since + idle)) {
+		delay = mq->idle_since + idle - jiffies;
+	} else if (ktime_to_ns(card->idle_bkops.start)) {
+		if (mmc_poll_idle_bkops(card))
+			delay = msecs_to_jiffies(MMC_IDLE_BKOPS_POLL_MS);
+		else
+			mq->idle_since = jiffies;
+	} else if (mmc_start_idle_bkops(card)) {
+		delay = msecs_to_jiffies(MMC_IDLE_BKOPS_POLL_MS);
+	}
+out:
+	up(&mq->thread_sem);
+	if (delay)
+		queue_delayed_work(system_freezable_wq, &mq->idle_work, delay);
+}
+
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void mmc_queue_early_suspend(struct early_suspend *h)
+{
+	struct mmc_queue *mq = container_of(h, struct mmc_queue,
+					    early_suspend);
+
+	mq->screen_off = true;
+	mmc_queue_arm_idle(mq, msecs_to_jiffies(mq->card->idle_bkops.idle_ms));
+}
+
+static void mmc_queue_late_resume(struct early_suspend *h)
+{
+	struct mmc_queue *mq = container_of(h, struct mmc_queue,
+					    early_suspend);
+
+	mq->screen_off = false;
+}
+#endif
+
+/*
+ * Called by the elevator, with the queue lock held, when a request that
+ * should be served ahead of the others is queued.  The queue thread
+ * then stops packing writes and holds back a prefetched write.
+ */
+static void mmc_urgent_request(struct request_queue *q)
+{
+	struct mmc_queue *mq = q->queuedata;
+	unsigned long flags;
+
+	if (!mq)
+		return;
+
+	spin_lock_irqsave(&mq->card->urgent_stats.lock, flags);
+	mq->card->urgent_stats.queued++;
+	spin_unlock_irqrestore(&mq->card->urgent_stats.lock, flags);
+
+	if (!mq->urgent_pending) {
+		mq->urgent_pending = true;
+		mq->urgent_start = ktime_get();
+	}
+}
+
 static int mmc_prep_request(struct request_queue *q, struct request *req)
 {
 	struct mmc_queue *mq = q->queuedata;
@@ -60,6 +150,13 @@ static int mmc_queue_thread(void *d)
 		set_current_state(TASK_INTERRUPTIBLE);
 		req = blk_fetch_request(q);
 		mq->mqrq_cur->req = req;
+		if (req && (req->cmd_flags & REQ_URGENT)) {
+			mq->mqrq_cur->urgent_start = mq->urgent_pending ?
+				mq->urgent_start : ktime_get();
+			mq->urgent_pending = false;
+		} else {
+			mq->mqrq_cur->urgent_start = ktime_set(0, 0);
+		}
 		spin_unlock_irq(q->queue_lock);
 
 		if (req || mq->mqrq_prev->req) {
@@ -75,6 +172,9 @@ static int mmc_queue_thread(void *d)
 			}
 
 			mmc_start_bkops(mq->card);
+			if (mq->card->idle_bkops.idle_ms)
+				mmc_queue_arm_idle(mq, msecs_to_jiffies(
+					mq->card->idle_bkops.idle_ms));
 			up(&mq->thread_sem);
 			schedule();
 			down(&mq->thread_sem);
@@ -220,12 +320,19 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	memset(&mq->mqrq_prev, 0, sizeof(mq->mqrq_prev));
 	INIT_LIST_HEAD(&mqrq_cur->packed_list);
 	INIT_LIST_HEAD(&mqrq_prev->packed_list);
+	INIT_LIST_HEAD(&mq->held_discards);
+	INIT_DELAYED_WORK(&mq->idle_work, mmc_queue_idle_work);
+	mq->screen_off = true;
 	mq->mqrq_cur = mqrq_cur;
 	mq->mqrq_prev = mqrq_prev;
 	mq->queue->queuedata = mq;
 	mq->num_wr_reqs_to_start_packing = DEFAULT_NUM_REQS_TO_START_PACK;
+	if (!card->pack_policy.start_thresh)
+		card->pack_policy.start_thresh = DEFAULT_NUM_REQS_TO_START_PACK;
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
+	if (mmc_card_mmc(card))
+		blk_queue_urgent_request(mq->queue, mmc_urgent_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
@@ -320,6 +427,16 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 		goto free_bounce_sg;
 	}
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	if (mmc_card_mmc(card)) {
+		mq->screen_off = false;
+		mq->early_suspend.level = EARLY_SUSPEND_LEVEL_BLANK_SCREEN;
+		mq->early_suspend.suspend = mmc_queue_early_suspend;
+		mq->early_suspend.resume = mmc_queue_late_resume;
+		register_early_suspend(&mq->early_suspend);
+	}
+#endif
+
 	return 0;
  free_bounce_sg:
 	kfree(mqrq_cur->bounce_sg);
@@ -355,6 +472,12 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	
 	kthread_stop(mq->thread);
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	if (mmc_card_mmc(mq->card))
+		unregister_early_suspend(&mq->early_suspend);
+#endif
+	cancel_delayed_work_sync(&mq->idle_work);
+
 	
 	spin_lock_irqsave(q->queue_lock, flags);
 	q->queuedata = NULL;
@@ -395,7 +518,12 @@ void mmc_queue_suspend(struct mmc_queue *mq)
 		blk_stop_queue(q);
 		spin_unlock_irqrestore(q->queue_lock, flags);
 
+		cancel_delayed_work_sync(&mq->idle_work);
 		down(&mq->thread_sem);
+
+		/* the card must not be busy when the host suspends it */
+		if (mmc_card_doing_bkops(mq->card))
+			mmc_interrupt_bkops(mq->card);
 	}
 }
 
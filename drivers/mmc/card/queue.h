@@ -1,6 +1,9 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/earlysuspend.h>
+#include <linux/workqueue.h>
+
 struct request;
 struct task_struct;
 
@@ -42,6 +45,8 @@ struct mmc_queue_req {
 	enum mmc_packed_cmd	packed_cmd;
 	int		packed_fail_idx;
 	u8		packed_num;
+	bool		preempted;
+	ktime_t		urgent_start;
 };
 
 struct mmc_queue {
@@ -58,6 +63,17 @@ struct mmc_queue {
 	bool			wr_packing_enabled;
 	int			num_of_potential_packed_wr_reqs;
 	int			num_wr_reqs_to_start_packing;
+	bool			urgent_pending;
+	ktime_t			urgent_start;
+	struct list_head	held_discards;
+	unsigned int		nr_held_discards;
+	unsigned long		held_since;
+	struct delayed_work	idle_work;
+	unsigned long		idle_since;
+	bool			screen_off;
+#ifdef CONFIG_HAS_EARLYSUSPEND
+	struct early_suspend	early_suspend;
+#endif
 	int (*err_check_fn) (struct mmc_card *, struct mmc_async_req *);
 	void (*packed_test_fn) (struct request_queue *, struct mmc_queue_req *);
 };
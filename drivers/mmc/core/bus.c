@@ -245,6 +245,13 @@ struct mmc_card *mmc_alloc_card(struct mmc_host *host, struct device_type *type)
 	card->dev.type = type;
 
 	spin_lock_init(&card->wr_pack_stats.lock);
+	spin_lock_init(&card->urgent_stats.lock);
+	spin_lock_init(&card->pack_policy.lock);
+	spin_lock_init(&card->idle_bkops.lock);
+	card->idle_bkops.idle_ms = MMC_IDLE_BKOPS_MS;
+	card->idle_bkops.screen_off_only = 1;
+	card->idle_bkops.discard_batch = MMC_DISCARD_BATCH;
+	card->idle_bkops.discard_max_delay_ms = MMC_DISCARD_MAX_DELAY_MS;
 
 	return card;
 }
@@ -352,6 +359,7 @@ void mmc_remove_card(struct mmc_card *card)
 	}
 
 	kfree(card->wr_pack_stats.packing_events);
+	kfree(card->pack_policy.size);
 
 	put_device(&card->dev);
 }
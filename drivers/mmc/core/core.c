@@ -343,6 +343,122 @@ out:
 }
 EXPORT_SYMBOL(mmc_start_bkops);
 
+/*
+ * Starts BKOPS at any level other than 0, for the block driver to use
+ * while its queue is idle.  Returns 1 if BKOPS was started.  It is
+ * stopped with mmc_interrupt_bkops() as any other BKOPS.
+ */
+int mmc_start_idle_bkops(struct mmc_card *card)
+{
+	struct mmc_idle_bkops *ib = &card->idle_bkops;
+	unsigned long flags;
+	int err;
+
+	if (!card->ext_csd.bkops_en || !(card->host->caps2 & MMC_CAP2_BKOPS))
+		return 0;
+	if (mmc_card_doing_bkops(card) ||
+	    card->host->bkops_trigger == ENCRYPT_MAGIC_NUMBER2)
+		return 0;
+
+	mmc_claim_host(card->host);
+	err = mmc_read_bkops_status(card);
+	if (err || card->ext_csd.raw_bkops_status == EXT_CSD_BKOPS_LEVEL_0)
+		goto out;
+
+	err = mmc_switch(card, EXT_CSD_CMD_SET_NORMAL,
+			 EXT_CSD_BKOPS_START, 1, 0);
+	if (err) {
+		pr_warning("%s: error %d starting idle bkops\n",
+			   mmc_hostname(card->host), err);
+		goto out;
+	}
+
+	spin_lock_irqsave(&card->host->lock, flags);
+	mmc_card_clr_need_bkops(card);
+	mmc_card_set_doing_bkops(card);
+	spin_unlock_irqrestore(&card->host->lock, flags);
+
+	spin_lock_irqsave(&ib->lock, flags);
+	ib->starts++;
+	ib->start = ktime_get();
+	ib->poll_errors = 0;
+	spin_unlock_irqrestore(&ib->lock, flags);
+	err = 1;
+out:
+	mmc_release_host(card->host);
+	return err == 1;
+}
+EXPORT_SYMBOL(mmc_start_idle_bkops);
+
+static void mmc_idle_bkops_done(struct mmc_card *card, ktime_t now,
+				bool interrupted)
+{
+	struct mmc_idle_bkops *ib = &card->idle_bkops;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ib->lock, flags);
+	if (ktime_to_ns(ib->start)) {
+		ib->hidden_us += ktime_us_delta(now, ib->start);
+		if (interrupted) {
+			ib->interrupted++;
+			ib->hpi_us += ktime_us_delta(ktime_get(), now);
+		} else {
+			ib->completed++;
+		}
+		ib->start = ktime_set(0, 0);
+	}
+	spin_unlock_irqrestore(&ib->lock, flags);
+}
+
+/*
+ * Checks whether the BKOPS started by mmc_start_idle_bkops() is still
+ * running.  Returns 1 if it is, 0 once it is done or polling gave up.
+ *
+ * A failed CMD13 says nothing about the card, so it is retried on the
+ * next poll.  After MMC_IDLE_BKOPS_POLL_RETRIES failures in a row the
+ * BKOPS is no longer polled, but is left marked as running, so that the
+ * next request still stops it with HPI.
+ */
+int mmc_poll_idle_bkops(struct mmc_card *card)
+{
+	struct mmc_idle_bkops *ib = &card->idle_bkops;
+	unsigned long flags;
+	u32 status;
+	int err;
+
+	if (!mmc_card_doing_bkops(card)) {
+		/* stopped by somebody else */
+		mmc_idle_bkops_done(card, ktime_get(), false);
+		return 0;
+	}
+
+	mmc_claim_host(card->host);
+	err = mmc_send_status(card, &status);
+	mmc_release_host(card->host);
+	if (err) {
+		if (++ib->poll_errors < MMC_IDLE_BKOPS_POLL_RETRIES)
+			return 1;
+		pr_warning("%s: error %d polling idle bkops, giving up\n",
+			   mmc_hostname(card->host), err);
+		spin_lock_irqsave(&ib->lock, flags);
+		ib->start = ktime_set(0, 0);
+		spin_unlock_irqrestore(&ib->lock, flags);
+		ib->poll_errors = 0;
+		return 0;
+	}
+	ib->poll_errors = 0;
+	if (!(status & R1_READY_FOR_DATA) ||
+	    R1_CURRENT_STATE(status) == R1_STATE_PRG)
+		return 1;
+
+	spin_lock_irqsave(&card->host->lock, flags);
+	mmc_card_clr_doing_bkops(card);
+	spin_unlock_irqrestore(&card->host->lock, flags);
+	mmc_idle_bkops_done(card, ktime_get(), false);
+	return 0;
+}
+EXPORT_SYMBOL(mmc_poll_idle_bkops);
+
 static void mmc_wait_done(struct mmc_request *mrq)
 {
 	complete(&mrq->completion);
@@ -411,6 +527,7 @@ struct mmc_async_req *mmc_start_req(struct mmc_host *host,
 {
 	int err = 0;
 	int start_err = 0;
+	int defer = 0;
 	struct mmc_async_req *data = host->areq;
 
 	
@@ -440,19 +557,22 @@ struct mmc_async_req *mmc_start_req(struct mmc_host *host,
 		}
 	}
 
-	if (!err && areq) {
-		if (mmc_card_sd(host->card))
-			areq->rq_stime = ktime_get();
+	if (!err && areq && data && areq->should_defer &&
+	    areq->should_defer(host->card, areq))
+		defer = 1;
+
+	if (!err && !defer && areq) {
+		areq->rq_stime = ktime_get();
 		start_err = __mmc_start_req(host, areq->mrq);
 	}
 	if (host->areq)
 		mmc_post_req(host, host->areq->mrq, 0);
 
 	
-	if ((err || start_err) && areq)
+	if ((err || start_err || defer) && areq)
 			mmc_post_req(host, areq->mrq, -EINVAL);
 
-	if (err)
+	if (err || defer)
 		host->areq = NULL;
 	else
 		host->areq = areq;
@@ -532,6 +652,7 @@ int mmc_interrupt_bkops(struct mmc_card *card)
 {
 	int err = 0;
 	unsigned long flags;
+	ktime_t start = ktime_get();
 
 	BUG_ON(!card);
 
@@ -540,6 +661,7 @@ int mmc_interrupt_bkops(struct mmc_card *card)
 	spin_lock_irqsave(&card->host->lock, flags);
 	mmc_card_clr_doing_bkops(card);
 	spin_unlock_irqrestore(&card->host->lock, flags);
+	mmc_idle_bkops_done(card, start, true);
 	if (err)
 		pr_err("%s: send hpi fail : %d\n",
 		       mmc_hostname(card->host), err);
@@ -429,6 +429,13 @@ static ssize_t mmc_wr_pack_stats_read(struct file *filp, char __user *ubuf,
 			pack_stats->pack_stop_reason[THRESHOLD]);
 		strlcat(ubuf, temp_buf, cnt);
 	}
+	if (pack_stats->pack_stop_reason[URGENT_REQUEST]) {
+		snprintf(temp_buf, TEMP_BUF_SIZE,
+			 "%s: %d times: urgent request\n",
+			mmc_hostname(card->host),
+			pack_stats->pack_stop_reason[URGENT_REQUEST]);
+		strlcat(ubuf, temp_buf, cnt);
+	}
 
 	spin_unlock(&pack_stats->lock);
 
@@ -473,6 +480,179 @@ static const struct file_operations mmc_dbg_wr_pack_stats_fops = {
 	.write		= mmc_wr_pack_stats_write,
 };
 
+static int mmc_urgent_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_urgent_stats *stats = &card->urgent_stats;
+	struct mmc_urgent_stats snap;
+	int i;
+
+	spin_lock_irq(&stats->lock);
+	snap = *stats;
+	spin_unlock_irq(&stats->lock);
+
+	seq_printf(s, "queued:    %u\n", snap.queued);
+	seq_printf(s, "served:    %u\n", snap.served);
+	seq_printf(s, "preempted: %u\n", snap.preempted);
+	seq_printf(s, "packs_cut: %u\n", snap.packs_cut);
+	seq_printf(s, "avg_us:    %llu\n", snap.served ?
+		   div_u64(snap.total_us, snap.served) : 0);
+	seq_printf(s, "max_us:    %u\n", snap.max_us);
+	for (i = 0; i < MMC_URGENT_HIST_BUCKETS - 1; i++)
+		seq_printf(s, "<%-3d ms:   %u\n", 1 << i, snap.hist[i]);
+	seq_printf(s, ">=%-2d ms:   %u\n", 1 << (i - 1), snap.hist[i]);
+	return 0;
+}
+
+static int mmc_urgent_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_urgent_stats_show, inode->i_private);
+}
+
+/* Any write resets the statistics. */
+static ssize_t mmc_urgent_stats_write(struct file *filp,
+				      const char __user *ubuf, size_t cnt,
+				      loff_t *ppos)
+{
+	struct seq_file *s = filp->private_data;
+	struct mmc_card *card = s->private;
+	struct mmc_urgent_stats *stats = &card->urgent_stats;
+
+	spin_lock_irq(&stats->lock);
+	stats->queued = stats->served = 0;
+	stats->preempted = stats->packs_cut = 0;
+	stats->total_us = 0;
+	stats->max_us = 0;
+	memset(stats->hist, 0, sizeof(stats->hist));
+	spin_unlock_irq(&stats->lock);
+
+	return cnt;
+}
+
+static const struct file_operations mmc_dbg_urgent_stats_fops = {
+	.open		= mmc_urgent_stats_open,
+	.read		= seq_read,
+	.write		= mmc_urgent_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int mmc_pack_policy_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_pack_policy *pp = &card->pack_policy;
+	struct mmc_pack_size_stats *st;
+	int n;
+
+	spin_lock(&pp->lock);
+	seq_printf(s, "adaptive:          %u\n", pp->adaptive);
+	seq_printf(s, "latency_target_us: %u\n", pp->latency_target_us);
+	seq_printf(s, "start_thresh:      %d\n", pp->start_thresh);
+	seq_printf(s, "max_packed:        %u (card %u)\n", pp->max_packed,
+		   card->ext_csd.max_packed_writes);
+	seq_printf(s, "adjustments:       %u\n", pp->adjustments);
+	seq_printf(s, "packing_ratio:     %llu%%\n", pp->wr_reqs ?
+		   div64_u64(pp->packed_reqs * 100, pp->wr_reqs) : 0);
+	seq_printf(s, "size      nr   avg_us    KB/s\n");
+	for (n = 1; n <= card->ext_csd.max_packed_writes; n++) {
+		st = &pp->size[n];
+		if (!st->nr)
+			continue;
+		seq_printf(s, "%4d %7u %8llu %7llu\n", n, st->nr,
+			   div_u64(st->us, st->nr), st->us ?
+			   div64_u64(st->bytes * USEC_PER_SEC,
+				     st->us * 1024) : 0);
+	}
+	spin_unlock(&pp->lock);
+	return 0;
+}
+
+static int mmc_pack_policy_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_pack_policy_show, inode->i_private);
+}
+
+/* Any write drops the collected samples; the current limits stay. */
+static ssize_t mmc_pack_policy_write(struct file *filp,
+				     const char __user *ubuf, size_t cnt,
+				     loff_t *ppos)
+{
+	struct seq_file *s = filp->private_data;
+	struct mmc_card *card = s->private;
+	struct mmc_pack_policy *pp = &card->pack_policy;
+
+	spin_lock(&pp->lock);
+	memset(pp->size, 0, (card->ext_csd.max_packed_writes + 1) *
+	       sizeof(*pp->size));
+	pp->completions = 0;
+	pp->adjustments = 0;
+	pp->wr_reqs = pp->packed_reqs = 0;
+	spin_unlock(&pp->lock);
+
+	return cnt;
+}
+
+static const struct file_operations mmc_dbg_pack_policy_fops = {
+	.open		= mmc_pack_policy_open,
+	.read		= seq_read,
+	.write		= mmc_pack_policy_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int mmc_idle_bkops_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_idle_bkops *ib = &card->idle_bkops;
+	struct mmc_idle_bkops snap;
+
+	spin_lock_irq(&ib->lock);
+	snap = *ib;
+	spin_unlock_irq(&ib->lock);
+
+	seq_printf(s, "starts:          %u\n", snap.starts);
+	seq_printf(s, "completed:       %u\n", snap.completed);
+	seq_printf(s, "interrupted:     %u\n", snap.interrupted);
+	seq_printf(s, "hidden_ms:       %llu\n",
+		   div_u64(snap.hidden_us, USEC_PER_MSEC));
+	seq_printf(s, "hpi_us:          %llu\n", snap.hpi_us);
+	seq_printf(s, "running:         %d\n", ktime_to_ns(snap.start) != 0);
+	seq_printf(s, "discards_held:   %u\n", snap.discards_held);
+	seq_printf(s, "discard_flushes: %u\n", snap.discard_flushes);
+	return 0;
+}
+
+static int mmc_idle_bkops_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_idle_bkops_show, inode->i_private);
+}
+
+/* Any write resets the statistics. */
+static ssize_t mmc_idle_bkops_write(struct file *filp,
+				    const char __user *ubuf, size_t cnt,
+				    loff_t *ppos)
+{
+	struct seq_file *s = filp->private_data;
+	struct mmc_card *card = s->private;
+	struct mmc_idle_bkops *ib = &card->idle_bkops;
+
+	spin_lock_irq(&ib->lock);
+	ib->starts = ib->completed = ib->interrupted = 0;
+	ib->hidden_us = ib->hpi_us = 0;
+	ib->discards_held = ib->discard_flushes = 0;
+	spin_unlock_irq(&ib->lock);
+
+	return cnt;
+}
+
+static const struct file_operations mmc_dbg_idle_bkops_fops = {
+	.open		= mmc_idle_bkops_open,
+	.read		= seq_read,
+	.write		= mmc_idle_bkops_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -509,6 +689,44 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 					 &mmc_dbg_wr_pack_stats_fops))
 			goto err;
 
+	if (mmc_card_mmc(card))
+		if (!debugfs_create_file("urgent_stats", S_IRUSR | S_IWUSR,
+					 root, card, &mmc_dbg_urgent_stats_fops))
+			goto err;
+
+	if (mmc_card_mmc(card)) {
+		if (!debugfs_create_file("idle_bkops_stats", S_IRUSR | S_IWUSR,
+					 root, card, &mmc_dbg_idle_bkops_fops))
+			goto err;
+		if (!debugfs_create_u32("idle_bkops_ms", S_IRUSR | S_IWUSR,
+					root, &card->idle_bkops.idle_ms))
+			goto err;
+		if (!debugfs_create_bool("idle_bkops_screen_off_only",
+					 S_IRUSR | S_IWUSR, root,
+					 &card->idle_bkops.screen_off_only))
+			goto err;
+		if (!debugfs_create_u32("discard_batch", S_IRUSR | S_IWUSR,
+					root, &card->idle_bkops.discard_batch))
+			goto err;
+		if (!debugfs_create_u32("discard_max_delay_ms",
+					S_IRUSR | S_IWUSR, root,
+					&card->idle_bkops.discard_max_delay_ms))
+			goto err;
+	}
+
+	if (mmc_card_mmc(card) && card->pack_policy.size) {
+		if (!debugfs_create_file("wr_pack_policy", S_IRUSR | S_IWUSR,
+					 root, card, &mmc_dbg_pack_policy_fops))
+			goto err;
+		if (!debugfs_create_bool("wr_pack_adaptive", S_IRUSR | S_IWUSR,
+					 root, &card->pack_policy.adaptive))
+			goto err;
+		if (!debugfs_create_u32("wr_pack_latency_target_us",
+					S_IRUSR | S_IWUSR, root,
+					&card->pack_policy.latency_target_us))
+			goto err;
+	}
+
 	return;
 
 err:
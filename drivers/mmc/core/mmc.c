@@ -1236,6 +1236,17 @@ static int mmc_init_card(struct mmc_host *host, u32 ocr,
 				GFP_KERNEL);
 			if (!card->wr_pack_stats.packing_events)
 				goto free_card;
+
+			card->pack_policy.size = kzalloc(
+				(card->ext_csd.max_packed_writes + 1) *
+				sizeof(*card->pack_policy.size), GFP_KERNEL);
+			if (!card->pack_policy.size)
+				goto free_card;
+			card->pack_policy.adaptive = 1;
+			card->pack_policy.latency_target_us =
+				MMC_PACK_LATENCY_TARGET_US;
+			card->pack_policy.max_packed =
+				card->ext_csd.max_packed_writes;
 		}
 	}
 
@@ -27,6 +27,8 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 #include <asm/cacheflush.h>
@@ -35,6 +37,16 @@
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+/*
+ * Locking: each area's lock protects its fields and its unpinned ranges.
+ * ashmem_lru_lock protects the global LRU of unpinned, unpurged ranges and
+ * lru_count, and nests inside the area locks.  The shrinker walks the LRU
+ * under ashmem_lru_lock and only trylocks areas, so pin and unpin never
+ * wait for reclaim of other areas.
+ *
+ * @purging counts ranges of this area whose pages the shrinker is
+ * dropping outside of any lock; pinning waits for it to reach zero.
+ */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN]; 
 	struct list_head unpinned_list;	 
@@ -42,6 +54,8 @@ struct ashmem_area {
 	size_t size;			 
 	unsigned long vm_start;		 
 	unsigned long prot_mask;	 
+	struct mutex lock;
+	atomic_t purging;
 };
 
 struct ashmem_range {
@@ -53,11 +67,17 @@ struct ashmem_range {
 	unsigned int purged;		
 };
 
+/* unpinned ranges, least recently unpinned first */
 static LIST_HEAD(ashmem_lru_list);
 
 static unsigned long lru_count;
 
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_purge_wait);
+
+/* ranges the shrinker takes off the LRU before dropping its locks */
+#define ASHMEM_SHRINK_BATCH	16
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -86,21 +106,40 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
-static inline void lru_add(struct ashmem_range *range)
+/*
+ * Add a range to the LRU: at the tail if it was just unpinned, or right
+ * after @lru_prev if it was split off that range and so was unpinned at
+ * the same time.
+ */
+static inline void lru_add(struct ashmem_range *range,
+			   struct ashmem_range *lru_prev)
 {
-	list_add_tail(&range->lru, &ashmem_lru_list);
+	spin_lock(&ashmem_lru_lock);
+	if (lru_prev)
+		list_add(&range->lru, &lru_prev->lru);
+	else
+		list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
+	spin_unlock(&ashmem_lru_lock);
 }
 
-static inline void lru_del(struct ashmem_range *range)
+static inline void __lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+static inline void lru_del(struct ashmem_range *range)
+{
+	spin_lock(&ashmem_lru_lock);
+	__lru_del(range);
+	spin_unlock(&ashmem_lru_lock);
+}
+
 static int range_alloc(struct ashmem_area *asma,
 		       struct ashmem_range *prev_range, unsigned int purged,
-		       size_t start, size_t end)
+		       size_t start, size_t end,
+		       struct ashmem_range *lru_prev)
 {
 	struct ashmem_range *range;
 
@@ -120,7 +159,7 @@ static int range_alloc(struct ashmem_area *asma,
 	list_add_tail(&range->unpinned, &prev_range->unpinned);
 
 	if (range_on_lru(range))
-		lru_add(range);
+		lru_add(range, lru_prev);
 
 	return 0;
 }
@@ -141,8 +180,11 @@ static inline void range_shrink(struct ashmem_range *range,
 	range->pgstart = start;
 	range->pgend = end;
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -163,6 +205,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	}
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->lock);
+	atomic_set(&asma->purging, 0);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -175,10 +219,13 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
+
+	/* the shrinker may still be dropping pages it took off the LRU */
+	wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
 
 	if (asma->file)
 		fput(asma->file);
@@ -193,7 +240,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	
 	if (asma->size == 0)
@@ -212,7 +259,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	asma->file->f_pos = *pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -221,7 +268,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -241,7 +288,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -257,7 +304,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	
 	if (unlikely(!asma->size)) {
@@ -301,38 +348,84 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
-static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
+struct ashmem_purge {
+	struct ashmem_area *asma;
+	struct file *file;
+	loff_t start;
+	loff_t end;
+};
+
+/*
+ * Take up to ASHMEM_SHRINK_BATCH of the least recently unpinned ranges,
+ * about *nr_to_scan pages in total, off the LRU and mark them purged.
+ * Ranges of areas that are busy are skipped.  Returns the number of
+ * ranges taken and lowers *nr_to_scan by their size; their areas'
+ * purging counts stay raised until the pages have actually been dropped.
+ */
+static int ashmem_shrink_isolate(struct ashmem_purge *batch, int *nr_to_scan)
 {
 	struct ashmem_range *range, *next;
+	int nr = 0;
+
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
+		struct ashmem_area *asma = range->asma;
+
+		if (nr == ASHMEM_SHRINK_BATCH || *nr_to_scan <= 0)
+			break;
+		if (!mutex_trylock(&asma->lock))
+			continue;
+
+		batch[nr].asma = asma;
+		batch[nr].file = asma->file;
+		batch[nr].start = range->pgstart * PAGE_SIZE;
+		batch[nr].end = (range->pgend + 1) * PAGE_SIZE - 1;
+		get_file(asma->file);
+		atomic_inc(&asma->purging);
+		nr++;
+
+		range->purged = ASHMEM_WAS_PURGED;
+		__lru_del(range);
+		*nr_to_scan -= range_size(range);
+
+		mutex_unlock(&asma->lock);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return nr;
+}
+
+static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct ashmem_purge batch[ASHMEM_SHRINK_BATCH];
+	int nr_to_scan = sc->nr_to_scan;
 
 	
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
+	if (nr_to_scan && !(sc->gfp_mask & __GFP_FS))
 		return -1;
-	if (!sc->nr_to_scan)
+	if (!nr_to_scan)
 		return lru_count;
 
-	
-	if (!mutex_trylock(&ashmem_mutex)) {
-                return -1;
-	}
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	while (nr_to_scan > 0) {
+		int i, nr;
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
+		nr = ashmem_shrink_isolate(batch, &nr_to_scan);
+		if (!nr)
 			break;
+
+		for (i = 0; i < nr; i++) {
+			struct inode *inode = batch[i].file->f_dentry->d_inode;
+
+			vmtruncate_range(inode, batch[i].start, batch[i].end);
+			fput(batch[i].file);
+			if (atomic_dec_and_test(&batch[i].asma->purging))
+				wake_up_all(&ashmem_purge_wait);
+		}
 	}
-	mutex_unlock(&ashmem_mutex);
 
 	return lru_count;
 }
@@ -346,7 +439,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -361,7 +454,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 	return ret;
 }
 
@@ -369,7 +462,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	
 	if (unlikely(asma->file)) {
@@ -383,7 +476,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	asma->name[ASHMEM_FULL_NAME_LEN-1] = '\0';
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -392,7 +485,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		size_t len;
 
@@ -405,7 +498,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 					  sizeof(ASHMEM_NAME_DEF))))
 			ret = -EFAULT;
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -442,7 +535,7 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 			}
 
 			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+				    pgend + 1, range->pgend, range);
 			range_shrink(range, range->pgstart, pgstart - 1);
 			break;
 		}
@@ -473,7 +566,7 @@ restart:
 		}
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, range, purged, pgstart, pgend, NULL);
 }
 
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
@@ -523,10 +616,12 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->lock);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
+		/* pages being purged must be gone before they are reused */
+		wait_event(ashmem_purge_wait, !atomic_read(&asma->purging));
 		ret = ashmem_pin(asma, pgstart, pgend);
 		break;
 	case ASHMEM_UNPIN:
@@ -537,7 +632,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->lock);
 
 	return ret;
 }
@@ -648,10 +743,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->lock);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->lock);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
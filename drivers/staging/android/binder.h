@@ -37,6 +37,14 @@ enum {
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/*
+	 * Scheduling policy (SCHED_NORMAL, SCHED_FIFO, SCHED_RR or
+	 * SCHED_BATCH) that FLAT_BINDER_FLAG_PRIORITY_MASK applies to.  For
+	 * SCHED_NORMAL/SCHED_BATCH the priority is a nice value, for the RT
+	 * policies an rt_priority.
+	 */
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 0x600,
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
 };
 
 struct flat_binder_object {
@@ -113,6 +121,20 @@ struct binder_transaction_data {
 	} data;
 };
 
+struct iovec;
+
+/*
+ * BC_TRANSACTION_SG/BC_REPLY_SG: the payload is gathered from data_iov
+ * instead of transaction_data.data.ptr.buffer.  The iovec lengths must
+ * add up to transaction_data.data_size; offsets work as for
+ * BC_TRANSACTION and index into the gathered payload.
+ */
+struct binder_transaction_data_sg {
+	struct binder_transaction_data transaction_data;
+	const struct iovec	*data_iov;
+	size_t		data_iovcnt;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -191,6 +213,9 @@ enum BinderDriverCommandProtocol {
 	BC_CLEAR_DEATH_NOTIFICATION = _IOW('c', 15, struct binder_ptr_cookie),
 
 	BC_DEAD_BINDER_DONE = _IOW('c', 16, void *),
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
 };
 
 #endif 
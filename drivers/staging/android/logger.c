@@ -23,32 +23,91 @@
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
+#include <linux/ratelimit.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+#define LOGGER_ENTRY_MAX_LEN	(sizeof(struct logger_entry) + \
+				 LOGGER_ENTRY_MAX_PAYLOAD)
+
+/* entries up to this size are staged on the writer's stack */
+#define LOGGER_STAGE_INLINE	256
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/* uncompressed size of a chunk; must hold at least one maximal entry */
+#define LOGGER_CHUNK_SIZE	(16 * 1024)
+#define LOGGER_CHUNK_ALIGN	16
+
+/*
+ * A compressed chunk in the log buffer.  Chunks never wrap: when the
+ * rest of the buffer is too short, a padding chunk with ulen 0 fills it
+ * and the real chunk starts at offset 0.
+ */
+struct logger_chunk {
+	unsigned long	start;
+	__u32		ulen;
+	__u32		clen;
+	unsigned char	data[0];
+};
+
+static DEFINE_SPINLOCK(logger_lzo_lock);
+static void *logger_lzo_wrkmem;
+static unsigned char *logger_lzo_dst;
+#endif
+
+/*
+ * w_off and head are free-running byte positions; logger_offset() maps
+ * them into the buffer.  Writers serialize on lock only while copying an
+ * already staged entry into the buffer.  Readers never take it: they
+ * copy an entry out and then check that head has not moved past it, in
+ * which case the entry was overwritten and they resync to head.
+ */
 struct logger_log {
 	unsigned char		*buffer;
 	struct miscdevice	misc;	
 	wait_queue_head_t	wq;	
-	struct list_head	readers; 
-	struct mutex		mutex;	
-	size_t			w_off;	
-	size_t			head;	
+	spinlock_t		lock;	
+	unsigned long		w_off;	
+	unsigned long		head;	
 	size_t			size;	
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	/*
+	 * Entries from open_start to w_off sit uncompressed in open; older
+	 * ones are in the chunks between the buffer positions c_head and
+	 * c_tail.
+	 */
+	unsigned char		*open;
+	unsigned long		open_start;
+	unsigned long		c_head;
+	unsigned long		c_tail;
+#endif
 };
 
 struct logger_reader {
 	struct logger_log	*log;	
-	struct list_head	list;	
-	size_t			r_off;	
+	struct mutex		mutex;	
+	unsigned long		r_off;	
 	bool			r_all;	
 	int			r_ver;	
+	union {
+		struct logger_entry	entry;
+		unsigned char		buf[LOGGER_ENTRY_MAX_LEN];
+	} r_entry;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	/* the last chunk this reader decompressed, covering c_start.. */
+	unsigned char		*c_buf;
+	unsigned long		c_start;
+	size_t			c_len;
+	unsigned long		c_next;
+#endif
 };
 
-size_t logger_offset(struct logger_log *log, size_t n)
+static inline size_t logger_offset(struct logger_log *log, unsigned long n)
 {
 	return n & (log->size-1);
 }
@@ -63,27 +122,9 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
-static struct logger_entry *get_entry_header(struct logger_log *log,
-		size_t off, struct logger_entry *scratch)
+static inline bool log_is_stale(struct logger_log *log, unsigned long pos)
 {
-	size_t len = min(sizeof(struct logger_entry), log->size - off);
-	if (len != sizeof(struct logger_entry)) {
-		memcpy(((void *) scratch), log->buffer + off, len);
-		memcpy(((void *) scratch) + len, log->buffer,
-			sizeof(struct logger_entry) - len);
-		return scratch;
-	}
-
-	return (struct logger_entry *) (log->buffer + off);
-}
-
-static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
-{
-	struct logger_entry scratch;
-	struct logger_entry *entry;
-
-	entry = get_entry_header(log, off, &scratch);
-	return entry->len;
+	return (long)(pos - ACCESS_ONCE(log->head)) < 0;
 }
 
 static size_t get_user_hdr_len(int ver)
@@ -118,57 +159,354 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 	return copy_to_user(buf, hdr, hdr_len);
 }
 
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
-{
-	struct logger_entry scratch;
-	struct logger_entry *entry;
-	size_t len;
-	size_t msg_start;
+#ifndef CONFIG_ANDROID_LOGGER_COMPRESS
 
-	entry = get_entry_header(log, reader->r_off, &scratch);
-	if (copy_header_to_user(reader->r_ver, entry, buf))
-		return -EFAULT;
+static void log_copy_out(struct logger_log *log, void *dst,
+			 unsigned long pos, size_t count)
+{
+	size_t off = logger_offset(log, pos);
+	size_t len = min(count, log->size - off);
 
-	count -= get_user_hdr_len(reader->r_ver);
-	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	memcpy(dst, log->buffer + off, len);
+	if (count != len)
+		memcpy(dst + len, log->buffer, count - len);
+}
 
-	len = min(count, log->size - msg_start);
-	if (copy_to_user(buf, log->buffer + msg_start, len))
-		return -EFAULT;
+static void log_copy_in(struct logger_log *log, unsigned long pos,
+			const void *src, size_t count)
+{
+	size_t off = logger_offset(log, pos);
+	size_t len = min(count, log->size - off);
 
+	memcpy(log->buffer + off, src, len);
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(log->buffer, src + len, count - len);
+}
+
+static __u32 get_entry_msg_len(struct logger_log *log, unsigned long pos)
+{
+	struct logger_entry entry;
+
+	log_copy_out(log, &entry, pos, sizeof(entry));
+	return entry.len;
+}
+
+/*
+ * Copy the entry at pos into reader->r_entry.  Returns -EAGAIN if it was
+ * overwritten while being copied.
+ */
+static int log_read_entry(struct logger_log *log,
+			  struct logger_reader *reader, unsigned long pos)
+{
+	struct logger_entry *entry = &reader->r_entry.entry;
+
+	log_copy_out(log, entry, pos, sizeof(*entry));
+	smp_rmb();
+	if (log_is_stale(log, pos))
+		return -EAGAIN;
+
+	log_copy_out(log, entry->msg, pos + sizeof(*entry), entry->len);
+	smp_rmb();
+	if (log_is_stale(log, pos))
+		return -EAGAIN;
+
+	return 0;
+}
+
+/*
+ * Drop the oldest entries until len more bytes fit.  Each entry is only
+ * stepped over once, so this is O(1) amortized per write, and readers
+ * left behind notice on their own the next time they look at the log.
+ * Called with log->lock held.
+ */
+static void logger_make_room(struct logger_log *log, size_t len)
+{
+	unsigned long head = log->head;
+
+	while (log->w_off + len - head > log->size)
+		head += sizeof(struct logger_entry) +
+			get_entry_msg_len(log, head);
+
+	ACCESS_ONCE(log->head) = head;
+}
+
+/* Append an entry and publish it.  Called with log->lock held. */
+static void logger_store_entry(struct logger_log *log,
+			       const struct logger_entry *entry, size_t len)
+{
+	logger_make_room(log, len);
+	/* readers must see the new head before the old data goes away */
+	smp_wmb();
+	log_copy_in(log, log->w_off, entry, len);
+	/* and the new entry before they see the new w_off */
+	smp_wmb();
+	ACCESS_ONCE(log->w_off) = log->w_off + len;
+}
+
+static void logger_flush(struct logger_log *log)
+{
+	ACCESS_ONCE(log->head) = log->w_off;
+}
+
+#else
+
+static inline struct logger_chunk *log_chunk(struct logger_log *log,
+					     unsigned long pos)
+{
+	return (struct logger_chunk *)(log->buffer + logger_offset(log, pos));
+}
+
+static inline size_t chunk_size(size_t clen)
+{
+	return ALIGN(sizeof(struct logger_chunk) + clen, LOGGER_CHUNK_ALIGN);
+}
+
+static inline bool chunk_is_stale(struct logger_log *log, unsigned long pos)
+{
+	return (long)(pos - ACCESS_ONCE(log->c_head)) < 0;
+}
+
+/*
+ * Decompress the chunk holding pos, which is reader->r_off, into
+ * reader->c_buf.  The walk starts at the chunk after the one the reader
+ * decoded last, which is where a sequential reader needs to go, and
+ * falls back to the oldest chunk.
+ *
+ * -EAGAIN means the reader should retry at reader->r_off: either the
+ * writer overwrote what was being read, or the chunk is corrupt and
+ * r_off has been moved past it.
+ */
+static int log_load_chunk(struct logger_log *log,
+			  struct logger_reader *reader, unsigned long pos)
+{
+	struct logger_chunk chunk;
+	unsigned long cpos, c_head, c_tail, skip;
+	bool from_head;
+	size_t ulen;
+	int ret;
+
+	c_tail = ACCESS_ONCE(log->c_tail);
+	smp_rmb();
+	c_head = ACCESS_ONCE(log->c_head);
+	cpos = reader->c_next;
+	if (!reader->c_len || chunk_is_stale(log, cpos) ||
+	    (long)(c_tail - cpos) < 0)
+		cpos = c_head;
+	from_head = cpos == c_head;
+	reader->c_len = 0;
+
+	for (;;) {
+		if ((long)(cpos - c_tail) >= 0) {
+			/* a reader moved back to head is behind c_next */
+			if (!from_head) {
+				cpos = c_head;
+				from_head = true;
+				continue;
+			}
+			if (log_is_stale(log, pos) || chunk_is_stale(log, c_head))
+				return -EAGAIN;
+			pr_err_ratelimited("logger: %s: no chunk holds %lu\n",
+					   log->misc.name, pos);
+			reader->r_off = ACCESS_ONCE(log->open_start);
+			return -EAGAIN;
+		}
+
+		memcpy(&chunk, log_chunk(log, cpos), sizeof(chunk));
+		smp_rmb();
+		if (chunk_is_stale(log, cpos))
+			return -EAGAIN;
+
+		if (chunk.ulen && (long)(pos - chunk.start) >= 0 &&
+		    pos - chunk.start < chunk.ulen)
+			break;
+		cpos += chunk_size(chunk.clen);
+	}
+
+	ulen = LOGGER_CHUNK_SIZE;
+	ret = lzo1x_decompress_safe(log_chunk(log, cpos)->data, chunk.clen,
+				    reader->c_buf, &ulen);
+	smp_rmb();
+	if (chunk_is_stale(log, cpos))
+		return -EAGAIN;
+	if (ret != LZO_E_OK || ulen != chunk.ulen) {
+		pr_err_ratelimited("logger: %s: corrupt chunk at %lu\n",
+				   log->misc.name, cpos);
+		skip = ACCESS_ONCE(log->open_start);
+		if ((long)(chunk.start + chunk.ulen - skip) < 0)
+			skip = chunk.start + chunk.ulen;
+		reader->r_off = skip;
+		return -EAGAIN;
+	}
+
+	reader->c_start = chunk.start;
+	reader->c_len = ulen;
+	reader->c_next = cpos + chunk_size(chunk.clen);
+	return 0;
+}
+
+static int log_read_entry(struct logger_log *log,
+			  struct logger_reader *reader, unsigned long pos)
+{
+	struct logger_entry *entry = &reader->r_entry.entry;
+	unsigned long open_start;
+	size_t off;
+	int ret;
+
+	open_start = ACCESS_ONCE(log->open_start);
+	smp_rmb();
+	if ((long)(pos - open_start) >= 0) {
+		off = pos - open_start;
+		memcpy(entry, log->open + off, sizeof(*entry));
+		smp_rmb();
+		if (ACCESS_ONCE(log->open_start) != open_start)
+			return -EAGAIN;
+		memcpy(entry->msg, log->open + off + sizeof(*entry),
+		       entry->len);
+		smp_rmb();
+		if (ACCESS_ONCE(log->open_start) != open_start)
+			return -EAGAIN;
+		return 0;
+	}
+
+	if (!reader->c_len || (long)(pos - reader->c_start) < 0 ||
+	    pos - reader->c_start >= reader->c_len) {
+		ret = log_load_chunk(log, reader, pos);
+		if (ret)
+			return ret;
+	}
+
+	off = pos - reader->c_start;
+	memcpy(entry, reader->c_buf + off, sizeof(*entry));
+	memcpy(entry->msg, reader->c_buf + off + sizeof(*entry), entry->len);
+	return 0;
+}
+
+/*
+ * Compress the open chunk into the log buffer, dropping the oldest
+ * chunks to make room, and start a new open chunk at w_off.  Called
+ * with log->lock held.
+ */
+static void logger_seal_chunk(struct logger_log *log)
+{
+	size_t ulen = log->w_off - log->open_start;
+	struct logger_chunk chunk;
+	unsigned long c_head, c_tail;
+	size_t clen, pad, need;
+
+	if (!ulen)
+		return;
+
+	spin_lock(&logger_lzo_lock);
+	lzo1x_1_compress(log->open, ulen, logger_lzo_dst, &clen,
+			 logger_lzo_wrkmem);
+
+	need = chunk_size(clen);
+	c_tail = log->c_tail;
+	pad = log->size - logger_offset(log, c_tail);
+	if (pad >= need)
+		pad = 0;
+
+	c_head = log->c_head;
+	while (c_tail + pad + need - c_head > log->size)
+		c_head += chunk_size(log_chunk(log, c_head)->clen);
+	ACCESS_ONCE(log->c_head) = c_head;
+	ACCESS_ONCE(log->head) = c_head != c_tail ?
+		log_chunk(log, c_head)->start : log->open_start;
+	/* readers must see the new heads before the old chunks go away */
+	smp_wmb();
+
+	chunk.start = log->open_start;
+	if (pad) {
+		chunk.ulen = 0;
+		chunk.clen = pad - sizeof(chunk);
+		memcpy(log_chunk(log, c_tail), &chunk, sizeof(chunk));
+		c_tail += pad;
+	}
+	chunk.ulen = ulen;
+	chunk.clen = clen;
+	memcpy(log_chunk(log, c_tail), &chunk, sizeof(chunk));
+	memcpy(log_chunk(log, c_tail)->data, logger_lzo_dst, clen);
+	spin_unlock(&logger_lzo_lock);
+
+	/* publish the chunk before the entries leave the open chunk */
+	smp_wmb();
+	ACCESS_ONCE(log->c_tail) = c_tail + need;
+	smp_wmb();
+	ACCESS_ONCE(log->open_start) = log->w_off;
+	/* and only then start overwriting the open chunk */
+	smp_wmb();
+}
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
+static void logger_store_entry(struct logger_log *log,
+			       const struct logger_entry *entry, size_t len)
+{
+	if (log->w_off + len - log->open_start > LOGGER_CHUNK_SIZE)
+		logger_seal_chunk(log);
 
-	return count + get_user_hdr_len(reader->r_ver);
+	memcpy(log->open + (log->w_off - log->open_start), entry, len);
+	smp_wmb();
+	ACCESS_ONCE(log->w_off) = log->w_off + len;
 }
 
-static size_t get_next_entry_by_uid(struct logger_log *log,
-		size_t off, uid_t euid)
+static void logger_flush(struct logger_log *log)
 {
-	while (off != log->w_off) {
-		struct logger_entry *entry;
-		struct logger_entry scratch;
-		size_t next_len;
+	ACCESS_ONCE(log->c_head) = log->c_tail;
+	ACCESS_ONCE(log->head) = log->w_off;
+	smp_wmb();
+	ACCESS_ONCE(log->open_start) = log->w_off;
+}
 
-		entry = get_entry_header(log, off, &scratch);
+#endif /* CONFIG_ANDROID_LOGGER_COMPRESS */
 
-		if (entry->euid == euid)
-			return off;
+/*
+ * Copy the next entry this reader may see into reader->r_entry and
+ * return its size in the log, or 0 if there is none.  Called with
+ * reader->mutex held.  Entries of other uids are skipped for readers
+ * without r_all, and a reader that has been lapped restarts at head.
+ */
+static size_t logger_fetch_entry(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	struct logger_entry *entry = &reader->r_entry.entry;
+	unsigned long w_off;
+	size_t len;
+
+	for (;;) {
+		w_off = ACCESS_ONCE(log->w_off);
+		smp_rmb();
+		if (log_is_stale(log, reader->r_off))
+			reader->r_off = ACCESS_ONCE(log->head);
+		if (reader->r_off == w_off)
+			return 0;
+
+		if (log_read_entry(log, reader, reader->r_off))
+			continue;
+
+		len = sizeof(*entry) + entry->len;
+		if (!reader->r_all && entry->euid != current_euid()) {
+			reader->r_off += len;
+			continue;
+		}
 
-		next_len = sizeof(struct logger_entry) + entry->len;
-		off = logger_offset(log, off + next_len);
+		return len;
 	}
+}
+
+static ssize_t do_read_log_to_user(struct logger_reader *reader,
+				   char __user *buf, size_t len)
+{
+	struct logger_entry *entry = &reader->r_entry.entry;
+
+	if (copy_header_to_user(reader->r_ver, entry, buf))
+		return -EFAULT;
 
-	return off;
+	buf += get_user_hdr_len(reader->r_ver);
+	if (copy_to_user(buf, entry->msg, entry->len))
+		return -EFAULT;
+
+	reader->r_off += len;
+
+	return get_user_hdr_len(reader->r_ver) + entry->len;
 }
 
 /*
@@ -188,17 +526,15 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t len;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
-		mutex_lock(&log->mutex);
-
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		ret = (ACCESS_ONCE(log->w_off) == reader->r_off);
 		if (!ret)
 			break;
 
@@ -219,163 +555,97 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
 
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	len = logger_fetch_entry(log, reader);
+	if (unlikely(!len)) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
 	
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + reader->r_entry.entry.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(reader, buf, len);
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
-{
-	size_t count = 0;
-
-	do {
-		size_t nr = sizeof(struct logger_entry) +
-			get_entry_msg_len(log, off);
-		off = logger_offset(log, off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-static inline int is_between(size_t a, size_t b, size_t c)
-{
-	if (a < b) {
-		
-		if (a < c && c <= b)
-			return 1;
-	} else {
-		
-		if (c <= b || a < c)
-			return 1;
-	}
-
-	return 0;
-}
-
-static void fix_up_readers(struct logger_log *log, size_t len)
-{
-	size_t old = log->w_off;
-	size_t new = logger_offset(log, old + len);
-	struct logger_reader *reader;
-
-	if (is_between(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
-}
-
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
-}
-
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
-{
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	log->w_off = logger_offset(log, log->w_off + count);
-
-	return count;
-}
-
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
-	struct logger_entry header;
+	union {
+		struct logger_entry	entry;
+		unsigned char		buf[LOGGER_STAGE_INLINE];
+	} stage;
+	struct logger_entry *header;
 	struct timespec now;
+	size_t len, copied = 0;
 	ssize_t ret = 0;
 
-	now = current_kernel_time();
-
-	header.pid = current->tgid;
-	header.tid = current->pid;
-	header.sec = now.tv_sec;
-	header.nsec = now.tv_nsec;
-	header.euid = current_euid();
-	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
-	header.hdr_size = sizeof(struct logger_entry);
+	len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
 
 	
-	if (unlikely(!header.len))
+	if (unlikely(!len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	/*
+	 * Copy the entry in from userspace before taking log->lock, so
+	 * that a page fault in one writer never stalls the others.
+	 */
+	if (sizeof(*header) + len <= sizeof(stage)) {
+		header = &stage.entry;
+	} else {
+		header = kmalloc(sizeof(*header) + len, GFP_KERNEL);
+		if (!header)
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	while (nr_segs-- > 0 && copied < len) {
+		size_t seg;
 
 		
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		seg = min_t(size_t, iov->iov_len, len - copied);
 
-		
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (copy_from_user(header->msg + copied, iov->iov_base, seg)) {
+			ret = -EFAULT;
+			goto out;
 		}
 
 		iov++;
-		ret += nr;
+		copied += seg;
 	}
 
-	mutex_unlock(&log->mutex);
+	now = current_kernel_time();
+
+	header->pid = current->tgid;
+	header->tid = current->pid;
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+	header->euid = current_euid();
+	header->len = copied;
+	header->hdr_size = sizeof(struct logger_entry);
+
+	spin_lock(&log->lock);
+	logger_store_entry(log, header, sizeof(*header) + copied);
+	spin_unlock(&log->lock);
 
 	
 	wake_up_interruptible(&log->wq);
 
+	ret = copied;
+out:
+	if (header != &stage.entry)
+		kfree(header);
 	return ret;
 }
 
@@ -406,12 +676,17 @@ static int logger_open(struct inode *inode, struct file *file)
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
-		INIT_LIST_HEAD(&reader->list);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		reader->c_buf = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+		if (!reader->c_buf) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+		reader->c_len = 0;
+#endif
 
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+		reader->r_off = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -424,12 +699,10 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		kfree(reader->c_buf);
+#endif
 		kfree(reader);
 	}
 
@@ -450,14 +723,10 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (!reader->r_all)
-		reader->r_off = get_next_entry_by_uid(log,
-			reader->r_off, current_euid());
-
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	if (logger_fetch_entry(log, reader))
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -478,11 +747,15 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
+	unsigned long r_off;
 	long ret = -EINVAL;
 	void __user *argp = (void __user *) arg;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -493,26 +766,19 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		r_off = reader->r_off;
+		if (log_is_stale(log, r_off))
+			r_off = ACCESS_ONCE(log->head);
+		ret = ACCESS_ONCE(log->w_off) - r_off;
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-
-		if (!reader->r_all)
-			reader->r_off = get_next_entry_by_uid(log,
-				reader->r_off, current_euid());
-
-		if (log->w_off != reader->r_off)
+		if (logger_fetch_entry(log, reader))
 			ret = get_user_hdr_len(reader->r_ver) +
-				get_entry_msg_len(log, reader->r_off);
+				reader->r_entry.entry.len;
 		else
 			ret = 0;
 		break;
@@ -521,9 +787,9 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		spin_lock(&log->lock);
+		logger_flush(log);
+		spin_unlock(&log->lock);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -531,7 +797,6 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = reader->r_ver;
 		break;
 	case LOGGER_SET_VERSION:
@@ -539,12 +804,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader)
+		mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -561,7 +826,7 @@ static const struct file_operations logger_fops = {
 };
 
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(sizeof(long)); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -571,8 +836,7 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
@@ -600,10 +864,19 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	log->open = kmalloc(LOGGER_CHUNK_SIZE, GFP_KERNEL);
+	if (!log->open)
+		return -ENOMEM;
+#endif
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
 		       "device for log '%s'!\n", log->misc.name);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		kfree(log->open);
+#endif
 		return ret;
 	}
 
@@ -617,6 +890,16 @@ static int __init logger_init(void)
 {
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	logger_lzo_wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	logger_lzo_dst = vmalloc(lzo1x_worst_compress(LOGGER_CHUNK_SIZE));
+	if (!logger_lzo_wrkmem || !logger_lzo_dst) {
+		vfree(logger_lzo_wrkmem);
+		vfree(logger_lzo_dst);
+		return -ENOMEM;
+	}
+#endif
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
@@ -17,6 +17,11 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * While vmscan still reclaims at least reclaim_efficiency percent of the
+ * pages it scans, kills are deferred and the thresholds are not looked at
+ * again for ratelimit_ms.  Write 0 to reclaim_efficiency to kill as soon as
+ * a threshold is crossed.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -39,6 +44,11 @@
 #include <linux/notifier.h>
 #include <linux/mutex.h>
 #include <linux/delay.h>
+#include <linux/spinlock.h>
+#include <linux/vmstat.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 extern void show_meminfo(void);
 static uint32_t lowmem_debug_level = 2;
@@ -69,6 +79,19 @@ static int lowmem_fork_boost_minfree_size = 6;
 static size_t minfree_tmp[6] = {0, 0, 0, 0, 0, 0};
 
 static unsigned long lowmem_deathpending_timeout;
+static struct task_struct *lowmem_deathpending;
+
+/*
+ * While vmscan reclaims at least this percentage of the pages it scans,
+ * killing is deferred and the shrinker is not re-evaluated for
+ * lowmem_ratelimit_ms.  0 disables the check.
+ */
+static uint32_t lowmem_reclaim_efficiency = 75;
+static uint32_t lowmem_ratelimit_ms = 20;
+static unsigned long lowmem_next_scan;
+static unsigned long lowmem_last_scanned;
+static unsigned long lowmem_last_reclaimed;
+
 static unsigned long lowmem_fork_boost_timeout;
 static uint32_t lowmem_fork_boost = 0;
 
@@ -78,22 +101,6 @@ static uint32_t lowmem_fork_boost = 0;
 			printk(x);			\
 	} while (0)
 
-static int test_task_flag(struct task_struct *p, int flag)
-{
-	struct task_struct *t = p;
-
-	do {
-		task_lock(t);
-		if (test_tsk_thread_flag(t, flag)) {
-			task_unlock(t);
-			return 1;
-		}
-		task_unlock(t);
-	} while_each_thread(p, t);
-
-	return 0;
-}
-
 static int
 task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -129,14 +136,164 @@ static void dump_tasks(void)
 	}
 }
 
+/*
+ * Thread group leaders indexed by oom_score_adj, so that picking a victim
+ * only looks at the highest non-empty bucket instead of every process.
+ * Leaders are added at fork, moved when oom_score_adj changes and dropped
+ * when they are released.  lowmem_adj_lock nests inside tasklist_lock and
+ * siglock, so it is always taken with interrupts off.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+/* at most this many tasks of one bucket are compared by size */
+#define LOWMEM_BUCKET_SCAN	16
+
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+static struct hlist_head lowmem_adj_index[LOWMEM_ADJ_BUCKETS];
+static DECLARE_BITMAP(lowmem_adj_used, LOWMEM_ADJ_BUCKETS);
+
+static void lowmem_adj_del(struct task_struct *p)
+{
+	int bucket = p->lowmem_adj - OOM_SCORE_ADJ_MIN;
+
+	hlist_del_init(&p->lowmem_adj_node);
+	if (hlist_empty(&lowmem_adj_index[bucket]))
+		clear_bit(bucket, lowmem_adj_used);
+}
+
+void lowmem_adj_update(struct task_struct *p)
+{
+	unsigned long flags;
+	int adj;
+
+	rcu_read_lock();
+	p = p->group_leader;
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	/* a task that was already released must not be put back */
+	if (!pid_alive(p))
+		goto out;
+
+	adj = p->signal->oom_score_adj;
+	if (!hlist_unhashed(&p->lowmem_adj_node)) {
+		if (p->lowmem_adj == adj)
+			goto out;
+		lowmem_adj_del(p);
+	}
+	p->lowmem_adj = adj;
+	hlist_add_head(&p->lowmem_adj_node,
+		       &lowmem_adj_index[adj - OOM_SCORE_ADJ_MIN]);
+	set_bit(adj - OOM_SCORE_ADJ_MIN, lowmem_adj_used);
+out:
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+	rcu_read_unlock();
+}
+
+void lowmem_adj_remove(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_adj_lock, flags);
+	if (!hlist_unhashed(&p->lowmem_adj_node))
+		lowmem_adj_del(p);
+	if (p == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+	spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+}
+
+/*
+ * Find the largest task in the highest bucket at or above min_score_adj.
+ * Returns the thread holding its mm with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select(int min_score_adj, int *tasksize)
+{
+	struct task_struct *cand[LOWMEM_BUCKET_SCAN];
+	struct task_struct *selected = NULL;
+	struct hlist_node *pos;
+	struct task_struct *t;
+	unsigned long flags;
+	unsigned long bucket, end = LOWMEM_ADJ_BUCKETS;
+	int n, i;
+
+	*tasksize = 0;
+	while (!selected) {
+		n = 0;
+		spin_lock_irqsave(&lowmem_adj_lock, flags);
+		bucket = end ? find_last_bit(lowmem_adj_used, end) : end;
+		if (bucket >= end ||
+		    (int)bucket + OOM_SCORE_ADJ_MIN < min_score_adj) {
+			spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+			break;
+		}
+		hlist_for_each_entry(t, pos, &lowmem_adj_index[bucket],
+				     lowmem_adj_node) {
+			if (t->flags & PF_KTHREAD)
+				continue;
+			get_task_struct(t);
+			cand[n++] = t;
+			if (n == LOWMEM_BUCKET_SCAN)
+				break;
+		}
+		spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+		end = bucket;
+
+		for (i = 0; i < n; i++) {
+			struct task_struct *p;
+			int size;
+
+			p = find_lock_task_mm(cand[i]);
+			if (p) {
+				size = get_mm_rss(p->mm);
+				if (size > *tasksize) {
+					if (selected)
+						put_task_struct(selected);
+					get_task_struct(p);
+					selected = p;
+					*tasksize = size;
+				}
+				task_unlock(p);
+			}
+			put_task_struct(cand[i]);
+		}
+	}
+
+	return selected;
+}
+
+/*
+ * Percentage of the pages scanned by vmscan since the last call that it
+ * managed to reclaim, or 0 if it has not scanned anything.  Called with
+ * scan_mutex held.
+ */
+static unsigned int lowmem_reclaim_rate(void)
+{
+	static unsigned long events[NR_VM_EVENT_ITEMS];
+	unsigned long scanned = 0, reclaimed = 0;
+	unsigned long d_scanned, d_reclaimed;
+	int i;
+
+	all_vm_events(events);
+	for (i = PGSTEAL_KSWAPD_NORMAL - ZONE_NORMAL;
+	     i < PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL; i++)
+		reclaimed += events[i];
+	for (i = PGSCAN_KSWAPD_NORMAL - ZONE_NORMAL;
+	     i <= PGSCAN_DIRECT_MOVABLE; i++)
+		scanned += events[i];
+
+	d_scanned = scanned - lowmem_last_scanned;
+	d_reclaimed = reclaimed - lowmem_last_reclaimed;
+	lowmem_last_scanned = scanned;
+	lowmem_last_reclaimed = reclaimed;
+
+	if (!d_scanned)
+		return 0;
+	return min(d_reclaimed * 100 / d_scanned, 100UL);
+}
+
 static DEFINE_MUTEX(scan_mutex);
 
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *tsk;
-	struct task_struct *selected = NULL;
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
@@ -200,75 +357,73 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 
 		return rem;
 	}
-	selected_oom_score_adj = min_score_adj;
-
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		trace_lowmem_defer(LOWMEM_DEFER_DEATHPENDING, min_score_adj,
+				   other_free, other_file, 0);
+		msleep_interruptible(20);
+		mutex_unlock(&scan_mutex);
+		return 0;
+	}
 
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+	if (lowmem_reclaim_efficiency) {
+		unsigned int efficiency;
 
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				rcu_read_unlock();
-				
-				msleep_interruptible(20);
-				mutex_unlock(&scan_mutex);
-				return 0;
-			}
+		if (time_before(jiffies, lowmem_next_scan)) {
+			trace_lowmem_defer(LOWMEM_DEFER_RATELIMIT,
+					   min_score_adj, other_free,
+					   other_file, 0);
+			mutex_unlock(&scan_mutex);
+			return 0;
 		}
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
+		efficiency = lowmem_reclaim_rate();
+		if (efficiency >= lowmem_reclaim_efficiency) {
+			lowmem_next_scan = jiffies +
+				msecs_to_jiffies(lowmem_ratelimit_ms);
+			trace_lowmem_defer(LOWMEM_DEFER_RECLAIM, min_score_adj,
+					   other_free, other_file, efficiency);
+			mutex_unlock(&scan_mutex);
+			return 0;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
 	}
+
+	selected = lowmem_select(min_score_adj, &selected_tasksize);
 	if (selected) {
+		unsigned long flags;
+
+		selected_oom_score_adj = selected->signal->oom_score_adj;
+		selected_oom_adj = selected->signal->oom_adj;
 		lowmem_print(1, "[%s] send sigkill to %d (%s), oom_adj %d, score_adj %d,"
 			" min_score_adj %d, size %dK, free %dK, file %dK, fork_boost %dK\n",
 			     current->comm, selected->pid, selected->comm,
 			     selected_oom_adj, selected_oom_score_adj,
 			     min_score_adj, selected_tasksize << 2,
 			     other_free << 2, other_file << 2, fork_boost << 2);
+		trace_lowmem_kill(selected, selected_oom_score_adj,
+				  min_score_adj, selected_tasksize,
+				  other_free, other_file);
 		lowmem_deathpending_timeout = jiffies + HZ;
 		if (selected_oom_adj < 7)
 		{
 			show_meminfo();
+			rcu_read_lock();
 			dump_tasks();
+			rcu_read_unlock();
 		}
 		send_sig(SIGKILL, selected, 0);
 		set_tsk_thread_flag(selected, TIF_MEMDIE);
+		spin_lock_irqsave(&lowmem_adj_lock, flags);
+		if (pid_alive(selected))
+			lowmem_deathpending = selected->group_leader;
+		spin_unlock_irqrestore(&lowmem_adj_lock, flags);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
-		rcu_read_unlock();
-		
+
 		msleep_interruptible(20);
-	}
-	else
-		rcu_read_unlock();
+	} else
+		trace_lowmem_defer(LOWMEM_DEFER_NO_VICTIM, min_score_adj,
+				   other_free, other_file, 0);
 
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
@@ -385,6 +540,9 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(reclaim_efficiency, lowmem_reclaim_efficiency, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(ratelimit_ms, lowmem_ratelimit_ms, uint, S_IRUGO | S_IWUSR);
 module_param_named(fork_boost, lowmem_fork_boost, uint, S_IRUGO | S_IWUSR);
 module_param_array_named(fork_boost_minfree, lowmem_fork_boost_minfree, uint,
 			 &lowmem_fork_boost_minfree_size, S_IRUGO | S_IWUSR);
@@ -0,0 +1,91 @@
+/*
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lowmem_kill,
+	TP_PROTO(struct task_struct *p, int oom_score_adj, int min_score_adj,
+		 int tasksize, int other_free, int other_file),
+	TP_ARGS(p, oom_score_adj, min_score_adj, tasksize, other_free,
+		other_file),
+	TP_STRUCT__entry(
+		__array(char, comm, TASK_COMM_LEN)
+		__field(pid_t, pid)
+		__field(int, oom_score_adj)
+		__field(int, min_score_adj)
+		__field(int, tasksize)
+		__field(int, other_free)
+		__field(int, other_file)
+	),
+	TP_fast_assign(
+		memcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid = p->pid;
+		__entry->oom_score_adj = oom_score_adj;
+		__entry->min_score_adj = min_score_adj;
+		__entry->tasksize = tasksize;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+	),
+	TP_printk("pid=%d comm=%s oom_score_adj=%d min_score_adj=%d "
+		  "size=%dK free=%dK file=%dK",
+		  __entry->pid, __entry->comm, __entry->oom_score_adj,
+		  __entry->min_score_adj, __entry->tasksize << 2,
+		  __entry->other_free << 2, __entry->other_file << 2)
+);
+
+#define LOWMEM_DEFER_DEATHPENDING	0
+#define LOWMEM_DEFER_RATELIMIT		1
+#define LOWMEM_DEFER_RECLAIM		2
+#define LOWMEM_DEFER_NO_VICTIM		3
+
+TRACE_EVENT(lowmem_defer,
+	TP_PROTO(int reason, int min_score_adj, int other_free,
+		 int other_file, unsigned int efficiency),
+	TP_ARGS(reason, min_score_adj, other_free, other_file, efficiency),
+	TP_STRUCT__entry(
+		__field(int, reason)
+		__field(int, min_score_adj)
+		__field(int, other_free)
+		__field(int, other_file)
+		__field(unsigned int, efficiency)
+	),
+	TP_fast_assign(
+		__entry->reason = reason;
+		__entry->min_score_adj = min_score_adj;
+		__entry->other_free = other_free;
+		__entry->other_file = other_file;
+		__entry->efficiency = efficiency;
+	),
+	TP_printk("reason=%s min_score_adj=%d free=%dK file=%dK "
+		  "efficiency=%u%%",
+		  __print_symbolic(__entry->reason,
+			{ LOWMEM_DEFER_DEATHPENDING,	"deathpending" },
+			{ LOWMEM_DEFER_RATELIMIT,	"ratelimit" },
+			{ LOWMEM_DEFER_RECLAIM,		"reclaim" },
+			{ LOWMEM_DEFER_NO_VICTIM,	"no_victim" }),
+		  __entry->min_score_adj, __entry->other_free << 2,
+		  __entry->other_file << 2, __entry->efficiency)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
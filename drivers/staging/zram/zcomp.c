@@ -0,0 +1,165 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/lzo.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include "zcomp.h"
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	kfree(zstrm->workmem);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zcomp_strm *zcomp_strm_alloc(gfp_t flags)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kmalloc(sizeof(*zstrm), flags);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->workmem = kmalloc(LZO1X_MEM_COMPRESS, flags);
+	zstrm->buffer = (void *)__get_free_pages(flags | __GFP_ZERO, 1);
+	if (!zstrm->workmem || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Get an idle stream, allocating a new one if fewer than max_strm exist,
+ * or wait for one to be released.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_first_entry(&comp->idle_strm,
+						 struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+
+		if (comp->avail_strm >= comp->max_strm) {
+			spin_unlock(&comp->strm_lock);
+			wait_event(comp->strm_wait,
+				   !list_empty(&comp->idle_strm));
+			continue;
+		}
+
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+
+		/* we are on the swap-out path, so no I/O here */
+		zstrm = zcomp_strm_alloc(GFP_NOIO);
+		if (zstrm)
+			return zstrm;
+
+		/* the first stream always exists, so waiting will not hang */
+		spin_lock(&comp->strm_lock);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* max_strm was lowered while this stream was in use */
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(zstrm);
+}
+
+void zcomp_set_max_streams(struct zcomp *comp, int max_strm)
+{
+	struct zcomp_strm *zstrm, *tmp;
+	LIST_HEAD(victims);
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = max_strm;
+	while (comp->avail_strm > max_strm &&
+	       !list_empty(&comp->idle_strm)) {
+		zstrm = list_first_entry(&comp->idle_strm,
+					 struct zcomp_strm, list);
+		list_move(&zstrm->list, &victims);
+		comp->avail_strm--;
+	}
+	spin_unlock(&comp->strm_lock);
+
+	list_for_each_entry_safe(zstrm, tmp, &victims, list)
+		zcomp_strm_free(zstrm);
+}
+
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		   size_t *dst_len)
+{
+	return lzo1x_1_compress(src, PAGE_SIZE, zstrm->buffer, dst_len,
+				zstrm->workmem);
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm, *tmp;
+
+	/* all streams are idle once the device is being reset */
+	list_for_each_entry_safe(zstrm, tmp, &comp->idle_strm, list)
+		zcomp_strm_free(zstrm);
+	kfree(comp);
+}
+
+struct zcomp *zcomp_create(int max_strm)
+{
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+
+	comp = kmalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max_strm;
+
+	zstrm = zcomp_strm_alloc(GFP_KERNEL);
+	if (!zstrm) {
+		kfree(comp);
+		return NULL;
+	}
+	list_add(&zstrm->list, &comp->idle_strm);
+	comp->avail_strm = 1;
+
+	return comp;
+}
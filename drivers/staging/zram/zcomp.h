@@ -0,0 +1,53 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+/* A compression workspace: LZO work memory plus an output buffer. */
+struct zcomp_strm {
+	void *workmem;
+	/* compressed output; two pages, LZO may expand the input */
+	unsigned char *buffer;
+	struct list_head list;
+};
+
+/*
+ * A pool of up to max_strm streams, so that up to max_strm writers can
+ * compress at the same time.  Streams beyond the first are allocated on
+ * demand; writers wait for an idle stream once max_strm are in use.
+ */
+struct zcomp {
+	spinlock_t strm_lock;
+	struct list_head idle_strm;
+	int avail_strm;
+	int max_strm;
+	wait_queue_head_t strm_wait;
+};
+
+struct zcomp *zcomp_create(int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+void zcomp_set_max_streams(struct zcomp *comp, int max_strm);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp_strm *zstrm, const unsigned char *src,
+		   size_t *dst_len);
+
+#endif
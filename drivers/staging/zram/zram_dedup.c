@@ -0,0 +1,210 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/lzo.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/*
+ * One hash bucket for every (1 << ZRAM_HASH_SHIFT) pages of disk,
+ * within the bounds below.
+ */
+#define ZRAM_HASH_SHIFT		4
+#define ZRAM_HASH_SIZE_MIN	(1 << 10)
+#define ZRAM_HASH_SIZE_MAX	(1 << 16)
+
+u32 zram_dedup_checksum(const unsigned char *mem)
+{
+	return jhash2((const u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_dedup_hash(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum % zram->hash_size];
+}
+
+/* Make a newly stored object available to later writes of the same data */
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+		       u32 checksum)
+{
+	struct zram_hash *hash;
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	if (!zram->use_dedup)
+		return;
+
+	new->checksum = checksum;
+	hash = zram_dedup_hash(zram, checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+			     const unsigned char *mem, unsigned char *buf)
+{
+	int ret;
+	bool match = false;
+	size_t clen = PAGE_SIZE;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
+	ret = lzo1x_decompress_safe(cmem + sizeof(struct zobj_header),
+				    entry->len, buf, &clen);
+	if (ret == LZO_E_OK && clen == PAGE_SIZE)
+		match = !memcmp(mem, buf, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for a stored object holding the same data as the page at @mem
+ * and take a reference on it. Candidates with a matching checksum are
+ * decompressed into @buf (at least PAGE_SIZE bytes) and compared in
+ * full, so a checksum collision never aliases two different pages.
+ *
+ * The comparison runs without hash->lock, on a reference taken under
+ * it, so that writes hashing to the same bucket do not wait for it.
+ * The reference also keeps the entry in the tree, so the walk can go on
+ * from it afterwards.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram,
+				   const unsigned char *mem, u32 checksum,
+				   unsigned char *buf)
+{
+	struct zram_hash *hash;
+	struct rb_node *rb_node, *prev;
+	struct zram_entry *entry;
+
+	hash = zram_dedup_hash(zram, checksum);
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = rb_node->rb_left;
+		else if (checksum > entry->checksum)
+			rb_node = rb_node->rb_right;
+		else
+			break;
+	}
+
+	if (!rb_node)
+		goto out;
+
+	/* Entries with equal checksums are adjacent; start at the first */
+	while ((prev = rb_prev(rb_node))) {
+		entry = rb_entry(prev, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+		rb_node = prev;
+	}
+
+	while (rb_node) {
+		entry = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (entry->checksum != checksum)
+			break;
+
+		entry->refcount++;
+		spin_unlock(&hash->lock);
+		if (zram_dedup_match(zram, entry, mem, buf))
+			return entry;
+		spin_lock(&hash->lock);
+
+		rb_node = rb_next(&entry->rb_node);
+		if (!--entry->refcount) {
+			/* freed meanwhile; store the page anew */
+			rb_erase(&entry->rb_node, &hash->rb_root);
+			spin_unlock(&hash->lock);
+			zram_entry_release(zram, entry);
+			return NULL;
+		}
+	}
+out:
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+/*
+ * Drop a reference to @entry and return how many are left. Once the
+ * last one is gone the entry is no longer found by zram_dedup_find(),
+ * and the caller frees it.
+ */
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	unsigned long refcount;
+
+	if (!zram->use_dedup)
+		return --entry->refcount;
+
+	hash = zram_dedup_hash(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return refcount;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	if (!zram->use_dedup)
+		return 0;
+
+	zram->hash_size = clamp_t(size_t, num_pages >> ZRAM_HASH_SHIFT,
+				  ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	zram->hash = vzalloc(zram->hash_size * sizeof(struct zram_hash));
+	if (!zram->hash) {
+		zram->hash_size = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
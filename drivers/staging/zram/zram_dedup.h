@@ -0,0 +1,42 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct zram;
+struct zram_entry;
+
+/* One bucket of the per-device table of stored objects, by checksum */
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+u32 zram_dedup_checksum(const unsigned char *mem);
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+		       u32 checksum);
+struct zram_entry *zram_dedup_find(struct zram *zram,
+				   const unsigned char *mem, u32 checksum,
+				   unsigned char *buf);
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+
+#endif
@@ -25,13 +25,16 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -133,10 +136,254 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t clen)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool,
+				  clen + sizeof(struct zobj_header));
+	if (!entry->handle) {
+		kfree(entry);
+		return NULL;
+	}
+	entry->len = clen;
+	entry->refcount = 1;
+
+	return entry;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	u32 len = entry->len;
+
+	/* other disk pages still hold the same data */
+	if (zram_dedup_put(zram, entry)) {
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, len);
+		return;
+	}
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, len);
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+}
+
+/*
+ * Free an entry whose last reference was the one zram_dedup_find() took
+ * to compare it.  The page that held it before saw that reference and
+ * accounted its free as dropping a duplicate, so undo that here.
+ */
+void zram_entry_release(struct zram *zram, struct zram_entry *entry)
+{
+	zram_stat64_add(zram, &zram->stats.dup_data_size, entry->len);
+	zram_stat64_sub(zram, &zram->stats.compr_size, entry->len);
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Backing device blocks are page sized and handed out from bd_bitmap.
+ * Block 0 is never used, so a written back page always has a non-zero
+ * table entry, like any other stored page.
+ */
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bd_lock);
+	blk = find_next_zero_bit(zram->bd_bitmap, zram->nr_bd_pages, 1);
+	if (blk < zram->nr_bd_pages)
+		__set_bit(blk, zram->bd_bitmap);
+	else
+		blk = 0;
+	spin_unlock(&zram->bd_lock);
+
+	return blk;
+}
+
+static void zram_bd_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bd_lock);
+	WARN_ON(!test_bit(blk, zram->bd_bitmap));
+	__clear_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_lock);
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously read or write one block of the backing device */
+static int zram_bd_rw(struct zram *zram, unsigned long blk,
+		      struct page *page, int rw)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret = 0;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &done;
+	if (bio_add_page(bio, page, PAGE_SIZE, 0) != PAGE_SIZE) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+struct zram_bd_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk;
+	struct page *page;
+	int ret;
+};
+
+static void zram_bd_read_fn(struct work_struct *work)
+{
+	struct zram_bd_read_work *rw;
+
+	rw = container_of(work, struct zram_bd_read_work, work);
+	rw->ret = zram_bd_rw(rw->zram, rw->blk, rw->page, READ);
+}
+
+/*
+ * Read the written back page at @index into @page.
+ *
+ * We are called from zram_make_request(), where any bio we submit is only
+ * queued on current->bio_list until we return, so waiting for it here
+ * would never finish.  Have a worker submit the read and wait for that.
+ */
+static int zram_bd_read_page(struct zram *zram, u32 index, struct page *page)
+{
+	struct zram_bd_read_work rw;
+
+	rw.zram = zram;
+	rw.blk = zram->table[index].bd_index;
+	rw.page = page;
+	INIT_WORK_ONSTACK(&rw.work, zram_bd_read_fn);
+	schedule_work(&rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	if (unlikely(rw.ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+		       rw.ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return rw.ret;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	return 0;
+}
+
+static void zram_bd_reset(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	vfree(zram->bd_bitmap);
+	zram->bd_bitmap = NULL;
+	zram->nr_bd_pages = 0;
+	kfree(zram->backing_dev);
+	zram->backing_dev = NULL;
+}
+
+/* Called with init_lock held for write, before initialization */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap;
+	char *name;
+	int ret;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+
+	bdev = blkdev_get_by_path(name, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out_free_name;
+	}
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto out_put;
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	zram_bd_reset(zram);
+	zram->bdev = bdev;
+	zram->backing_dev = name;
+	zram->nr_bd_pages = nr_pages;
+	zram->bd_bitmap = bitmap;
+	pr_info("setup backing device %s\n", name);
+
+	return 0;
+
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_free_name:
+	kfree(name);
+	return ret;
+}
+#else
+static inline void zram_bd_free_block(struct zram *zram, unsigned long blk)
+{
+}
+
+static inline int zram_bd_read_page(struct zram *zram, u32 index,
+				    struct page *page)
+{
+	return -EIO;
+}
+
+static inline void zram_bd_reset(struct zram *zram)
+{
+}
+#endif
+
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	void *handle = zram->table[index].handle;
 
+	/* Whatever is stored next was accessed just now */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	/* Tell a running writeback that the data it copied is stale */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
 	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
@@ -149,21 +396,28 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_bd_free_block(zram, zram->table[index].bd_index);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat64_sub(zram, &zram->stats.bd_count, 1);
+		goto out;
+	}
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		__free_page(handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat64_sub(zram, &zram->stats.compr_size,
+				zram->table[index].size);
 		goto out;
 	}
 
-	zs_free(zram->mem_pool, handle);
+	zram_entry_free(zram, zram->table[index].entry);
 
 	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size,
-			zram->table[index].size);
 	zram_stat_dec(&zram->stats.pages_stored);
 
 	zram->table[index].handle = NULL;
@@ -203,12 +457,45 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+static int handle_written_back_page(struct zram *zram, struct bio_vec *bvec,
+				    u32 index, int offset)
+{
+	struct page *page = bvec->bv_page;
+	unsigned char *user_mem, *mem;
+	int ret;
+
+	if (!is_partial_io(bvec)) {
+		ret = zram_bd_read_page(zram, index, page);
+		if (!ret)
+			flush_dcache_page(page);
+		return ret;
+	}
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_bd_read_page(zram, index, page);
+	if (!ret) {
+		user_mem = kmap_atomic(bvec->bv_page);
+		mem = kmap_atomic(page);
+		memcpy(user_mem + bvec->bv_offset, mem + offset, bvec->bv_len);
+		kunmap_atomic(mem);
+		kunmap_atomic(user_mem);
+		flush_dcache_page(bvec->bv_page);
+	}
+	__free_page(page);
+
+	return ret;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
 	size_t clen;
 	struct page *page;
+	struct zram_entry *entry;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
@@ -227,6 +514,19 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		return 0;
 	}
 
+	/*
+	 * zram->lock is only held for read here.  Every other change of
+	 * the flags, slot frees from swap included, is made with it held
+	 * for write, and concurrent readers only ever clear this bit, so
+	 * they cannot lose an update to each other.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_IDLE))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	/* Page was moved to the backing device */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+		return handle_written_back_page(zram, bvec, index, offset);
+
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
@@ -247,11 +547,11 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		uncmem = user_mem;
 	clen = PAGE_SIZE;
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	entry = zram->table[index].entry;
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
 
 	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    uncmem, &clen);
+				    entry->len, uncmem, &clen);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -259,7 +559,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	zs_unmap_object(zram->mem_pool, entry->handle);
 	kunmap_atomic(user_mem);
 
 	/* Should NEVER happen. Return bio error if it does. */
@@ -278,6 +578,7 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 {
 	int ret;
 	size_t clen = PAGE_SIZE;
+	struct zram_entry *entry;
 	struct zobj_header *zheader;
 	unsigned char *cmem;
 
@@ -287,19 +588,34 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 		return 0;
 	}
 
-	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle);
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		struct page *page = alloc_page(GFP_NOIO);
+
+		if (!page)
+			return -ENOMEM;
+		ret = zram_bd_read_page(zram, index, page);
+		if (!ret) {
+			cmem = kmap_atomic(page);
+			memcpy(mem, cmem, PAGE_SIZE);
+			kunmap_atomic(cmem);
+		}
+		__free_page(page);
+		return ret;
+	}
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(zram->table[index].handle);
 		memcpy(mem, cmem, PAGE_SIZE);
 		kunmap_atomic(cmem);
 		return 0;
 	}
 
+	entry = zram->table[index].entry;
+	cmem = zs_map_object(zram->mem_pool, entry->handle);
 	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    zram->table[index].size,
-				    mem, &clen);
-	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+				    entry->len, mem, &clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret != LZO_E_OK)) {
@@ -311,19 +627,28 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/*
+ * Compression runs without zram->lock held, using one of the streams of
+ * zram->comp, so writers on different CPUs compress in parallel.  The
+ * lock is only taken for write to swap the new object into the table.
+ *
+ * With use_dedup set, a page whose data is already stored takes a
+ * reference on the existing object instead of being compressed again.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
 	size_t clen;
-	void *handle;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
-	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	u32 checksum = 0;
+	struct page *page_store = NULL;
+	struct zram_entry *entry = NULL;
+	bool incompressible, dup = false;
+	struct zcomp_strm *zstrm;
+	struct page *page;
+	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -336,20 +661,17 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			ret = -ENOMEM;
 			goto out;
 		}
+		down_read(&zram->lock);
 		ret = zram_read_before_write(zram, uncmem, index);
+		up_read(&zram->lock);
 		if (ret) {
 			kfree(uncmem);
 			goto out;
 		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].handle ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	/* may sleep waiting for a stream, so before kmap_atomic() */
+	zstrm = zcomp_strm_find(zram->comp);
 
 	user_mem = kmap_atomic(page);
 
@@ -363,14 +685,50 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		kunmap_atomic(user_mem);
 		if (is_partial_io(bvec))
 			kfree(uncmem);
+		zcomp_strm_release(zram->comp, zstrm);
+
+		down_write(&zram->lock);
+		zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
-		goto out;
+		up_write(&zram->lock);
+		return 0;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	if (zram->use_dedup) {
+		checksum = zram_dedup_checksum(uncmem);
+		/* the stream buffer is free until we compress */
+		entry = zram_dedup_find(zram, uncmem, checksum,
+					zstrm->buffer);
+		zram_stat64_inc(zram, &zram->stats.dedup_lookups);
+		if (entry) {
+			kunmap_atomic(user_mem);
+			if (is_partial_io(bvec))
+				kfree(uncmem);
+			zcomp_strm_release(zram->comp, zstrm);
+
+			dup = true;
+			clen = entry->len;
+			zram_stat64_inc(zram, &zram->stats.dedup_hits);
+			zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+			goto store;
+		}
+	}
+
+	ret = zcomp_compress(zstrm, uncmem, &clen);
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 * Keep a copy in the stream buffer, the source is unmapped
+	 * (or freed) below.
+	 */
+	incompressible = ret == LZO_E_OK && clen > max_zpage_size;
+	if (unlikely(incompressible)) {
+		clen = PAGE_SIZE;
+		memcpy(zstrm->buffer, uncmem, PAGE_SIZE);
+	}
 
 	kunmap_atomic(user_mem);
 	if (is_partial_io(bvec))
@@ -378,70 +736,73 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (unlikely(ret != LZO_E_OK)) {
 		pr_err("Compression failed! err=%d\n", ret);
+		zcomp_strm_release(zram->comp, zstrm);
 		goto out;
 	}
 
-	/*
-	 * Page is incompressible. Store it as-is (uncompressed)
-	 * since we do not want to return too many disk write
-	 * errors which has side effect of hanging the system.
-	 */
-	if (unlikely(clen > max_zpage_size)) {
-		clen = PAGE_SIZE;
+	if (unlikely(incompressible)) {
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			pr_info("Error allocating memory for "
 				"incompressible page: %u\n", index);
+			zcomp_strm_release(zram->comp, zstrm);
 			ret = -ENOMEM;
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		handle = page_store;
-		src = kmap_atomic(page);
 		cmem = kmap_atomic(page_store);
-		goto memstore;
-	}
-
-	handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader));
-	if (!handle) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
-	}
-	cmem = zs_map_object(zram->mem_pool, handle);
-
-memstore:
+		memcpy(cmem, zstrm->buffer, clen);
+		kunmap_atomic(cmem);
+	} else {
+		entry = zram_entry_alloc(zram, clen);
+		if (!entry) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%zu\n", index, clen);
+			zcomp_strm_release(zram->comp, zstrm);
+			ret = -ENOMEM;
+			goto out;
+		}
+		cmem = zs_map_object(zram->mem_pool, entry->handle);
 #if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		/* Back-reference needed for memory defragmentation */
 		zheader = (struct zobj_header *)cmem;
 		zheader->table_idx = index;
 		cmem += sizeof(*zheader);
-	}
 #endif
+		memcpy(cmem, zstrm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		zram_dedup_insert(zram, entry, checksum);
+	}
+	zcomp_strm_release(zram->comp, zstrm);
 
-	memcpy(cmem, src, clen);
+store:
+	down_write(&zram->lock);
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		kunmap_atomic(cmem);
-		kunmap_atomic(src);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	if (unlikely(page_store)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+		zram->table[index].handle = page_store;
 	} else {
-		zs_unmap_object(zram->mem_pool, handle);
+		zram->table[index].entry = entry;
 	}
-
-	zram->table[index].handle = handle;
 	zram->table[index].size = clen;
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
 
+	up_write(&zram->lock);
+
+	if (!dup)
+		zram_stat64_add(zram, &zram->stats.compr_size, clen);
+
 	return 0;
 
 out:
@@ -450,19 +811,173 @@ out:
 	return ret;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Mark every page in RAM idle; any later access clears the mark */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		down_write(&zram->lock);
+		if (zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		up_write(&zram->lock);
+	}
+}
+
+static bool zram_wb_candidate(struct zram *zram, u32 index,
+			      enum zram_wb_mode mode)
+{
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_WB))
+		return false;
+
+	if (mode == ZRAM_WB_IDLE)
+		return zram_test_flag(zram, index, ZRAM_IDLE);
+	return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+}
+
+/*
+ * Move the pages selected by @mode to the backing device, one page at a
+ * time.  The page is copied out under zram->lock and written without it.
+ * Writes of the slot and frees of it, swap slot frees included (see
+ * zram_slot_free_notify()), are all done with zram->lock held for write
+ * and clear ZRAM_UNDER_WB, in which case the copy is dropped and the slot
+ * is left alone.
+ *
+ * Called with init_lock held for read, from process context.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	size_t index, num_pages = zram->disksize >> PAGE_SHIFT;
+	unsigned long blk = 0;
+	struct page *page;
+	void *mem;
+	int ret = 0;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	for (index = 0; index < num_pages; index++) {
+		if (!blk) {
+			blk = zram_bd_alloc_block(zram);
+			if (!blk) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		down_write(&zram->lock);
+		if (!zram_wb_candidate(zram, index, mode)) {
+			up_write(&zram->lock);
+			continue;
+		}
+		mem = kmap(page);
+		ret = zram_read_before_write(zram, mem, index);
+		kunmap(page);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		up_write(&zram->lock);
+		if (ret)
+			break;
+
+		ret = zram_bd_rw(zram, blk, page, WRITE);
+
+		down_write(&zram->lock);
+		if (ret || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			up_write(&zram->lock);
+			if (ret) {
+				pr_err("Backing device write failed! "
+				       "err=%d, page=%zu\n", ret, index);
+				break;
+			}
+			continue;
+		}
+
+		/* Release the RAM copy, the slot now points to the block */
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].bd_index = blk;
+		zram_stat_inc(&zram->stats.pages_stored);
+		up_write(&zram->lock);
+
+		zram_stat64_inc(zram, &zram->stats.bd_count);
+		zram_stat64_inc(zram, &zram->stats.bd_writes);
+		blk = 0;
+
+		cond_resched();
+	}
+
+	if (blk)
+		zram_bd_free_block(zram, blk);
+	__free_page(page);
+
+	return ret;
+}
+#endif
+
+/* Apply the slot frees queued by zram_slot_free_notify() */
+static void zram_handle_pending_free(struct zram *zram)
+{
+	struct zram_slot_free *free_rq;
+
+	spin_lock(&zram->slot_free_lock);
+	free_rq = zram->slot_free_rq;
+	zram->slot_free_rq = NULL;
+	spin_unlock(&zram->slot_free_lock);
+
+	while (free_rq) {
+		struct zram_slot_free *next = free_rq->next;
+
+		zram_free_page(zram, free_rq->index);
+		zram_stat64_inc(zram, &zram->stats.notify_free);
+		kfree(free_rq);
+		free_rq = next;
+	}
+}
+
+static void zram_slot_free(struct work_struct *work)
+{
+	struct zram *zram = container_of(work, struct zram, free_work);
+
+	down_read(&zram->init_lock);
+	if (zram->init_done) {
+		down_write(&zram->lock);
+		zram_handle_pending_free(zram);
+		up_write(&zram->lock);
+	}
+	up_read(&zram->init_lock);
+}
+
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
 
+	/* A free queued before this write must not hit the new data */
+	if (rw == WRITE && ACCESS_ONCE(zram->slot_free_rq)) {
+		down_write(&zram->lock);
+		zram_handle_pending_free(zram);
+		up_write(&zram->lock);
+	}
+
 	if (rw == READ) {
 		down_read(&zram->lock);
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
 		up_read(&zram->lock);
+	} else if (is_partial_io(bvec)) {
+		/* keep concurrent read-modify-writes of a page apart */
+		mutex_lock(&zram->rmw_lock);
+		ret = zram_bvec_write(zram, bvec, index, offset);
+		mutex_unlock(&zram->rmw_lock);
 	} else {
-		down_write(&zram->lock);
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
 	}
 
 	return ret;
@@ -583,12 +1098,20 @@ void __zram_reset_device(struct zram *zram)
 
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	/* Free the compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
+
+	/* Queued slot frees are moot, every page goes below */
+	spin_lock(&zram->slot_free_lock);
+	while (zram->slot_free_rq) {
+		struct zram_slot_free *free_rq = zram->slot_free_rq;
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+		zram->slot_free_rq = free_rq->next;
+		kfree(free_rq);
+	}
+	spin_unlock(&zram->slot_free_lock);
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
@@ -596,16 +1119,24 @@ void __zram_reset_device(struct zram *zram)
 		if (!handle)
 			continue;
 
+		/* The whole backing device is released below */
+		if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+			continue;
+
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
 			__free_page(handle);
 		else
-			zs_free(zram->mem_pool, handle);
+			zram_entry_free(zram, zram->table[index].entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	zs_destroy_pool(zram->mem_pool);
+	zram_dedup_fini(zram);
+	zram_bd_reset(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -635,17 +1166,9 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail_no_table;
-	}
-
-	zram->compress_buffer =
-		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating compression streams\n");
 		ret = -ENOMEM;
 		goto fail_no_table;
 	}
@@ -658,6 +1181,12 @@ int zram_init_device(struct zram *zram)
 		goto fail_no_table;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret) {
+		pr_err("Error allocating zram dedup hash table\n");
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
@@ -686,14 +1215,29 @@ fail:
 	return ret;
 }
 
+/*
+ * Called under swap_lock, so zram->lock cannot be taken here.  The free
+ * is queued instead and applied by free_work, or by the next write,
+ * with zram->lock held for write.
+ */
 static void zram_slot_free_notify(struct block_device *bdev,
 				unsigned long index)
 {
 	struct zram *zram;
+	struct zram_slot_free *free_rq;
 
 	zram = bdev->bd_disk->private_data;
-	zram_free_page(zram, index);
-	zram_stat64_inc(zram, &zram->stats.notify_free);
+	free_rq = kmalloc(sizeof(*free_rq), GFP_ATOMIC);
+	if (!free_rq)
+		return;
+
+	free_rq->index = index;
+	spin_lock(&zram->slot_free_lock);
+	free_rq->next = zram->slot_free_rq;
+	zram->slot_free_rq = free_rq;
+	spin_unlock(&zram->slot_free_lock);
+
+	schedule_work(&zram->free_work);
 }
 
 static const struct block_device_operations zram_devops = {
@@ -707,7 +1251,14 @@ static int create_device(struct zram *zram, int device_id)
 
 	init_rwsem(&zram->lock);
 	init_rwsem(&zram->init_lock);
+	mutex_init(&zram->rmw_lock);
 	spin_lock_init(&zram->stat64_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bd_lock);
+#endif
+	spin_lock_init(&zram->slot_free_lock);
+	INIT_WORK(&zram->free_work, zram_slot_free);
+	zram->max_comp_streams = num_online_cpus();
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -775,6 +1326,8 @@ static void destroy_device(struct zram *zram)
 		put_disk(zram->disk);
 	}
 
+	cancel_work_sync(&zram->free_work);
+
 	if (zram->queue)
 		blk_cleanup_queue(zram->queue);
 }
@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -74,14 +78,39 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page was not accessed since the last 'idle' sweep */
+	ZRAM_IDLE,
+
+	/* Page lives on the backing device, see table.bd_index */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A compressed object. With deduplication enabled, disk pages holding
+ * the same data share one entry.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 len;		/* compressed size (excluding header) */
+	u32 checksum;
+	unsigned long refcount;
+	void *handle;
+};
+
 /* Allocated for each disk page */
 struct table {
-	void *handle;
+	union {
+		void *handle;	/* ZRAM_UNCOMPRESSED: the page itself */
+		struct zram_entry *entry;
+		unsigned long bd_index;	/* ZRAM_WB: backing device block */
+	};
 	u16 size;	/* object size (excluding header) */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
@@ -95,6 +124,12 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 dedup_lookups;	/* writes checked for a duplicate */
+	u64 dedup_hits;		/* writes that found one */
+	u64 dup_data_size;	/* compressed bytes saved by dedup */
+	u64 bd_count;		/* pages currently on the backing device */
+	u64 bd_reads;		/* pages read back from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
@@ -103,12 +138,12 @@ struct zram_stats {
 
 struct zram {
 	struct zs_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct rw_semaphore lock; /* protect table and 32-bit stats against
+				   * concurrent reads and updates */
+	struct mutex rmw_lock;	/* serialize partial page writes */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,10 +154,40 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Number of writers that can compress in parallel */
+	int max_comp_streams;
+	/* Store identical pages once; set before initialization */
+	bool use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Set before initialization, released on reset */
+	struct block_device *bdev;
+	char *backing_dev;
+	unsigned long nr_bd_pages;
+	unsigned long *bd_bitmap;	/* blocks of bdev in use */
+	spinlock_t bd_lock;		/* protect bd_bitmap */
+#endif
+	/* Slot frees from swap, applied under zram->lock by free_work */
+	spinlock_t slot_free_lock;
+	struct zram_slot_free *slot_free_rq;
+	struct work_struct free_work;
 
 	struct zram_stats stats;
 };
 
+/* A swap slot freed from atomic context, waiting for zram->lock */
+struct zram_slot_free {
+	unsigned long index;
+	struct zram_slot_free *next;
+};
+
+/* Which pages zram_writeback() moves to the backing device */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,
+	ZRAM_WB_INCOMPRESSIBLE,
+};
+
 extern struct zram *zram_devices;
 unsigned int zram_get_num_devices(void);
 #ifdef CONFIG_SYSFS
@@ -130,6 +195,12 @@ extern struct attribute_group zram_disk_attr_group;
 #endif
 
 extern int zram_init_device(struct zram *zram);
+extern void zram_entry_release(struct zram *zram, struct zram_entry *entry);
 extern void __zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
 
 #endif
@@ -27,6 +27,9 @@
 #include <linux/cpumask.h>
 #include <linux/cpu.h>
 #include <linux/vmalloc.h>
+#include <linux/bit_spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "zsmalloc.h"
 #include "zsmalloc_int.h"
@@ -43,6 +46,9 @@
 /* per-cpu VM mapping areas for zspage accesses that cross page boundaries */
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+/* handles are words allocated from this cache, see zsmalloc_int.h */
+static struct kmem_cache *zs_handle_cache;
+
 static int is_first_page(struct page *page)
 {
 	return test_bit(PG_private, &page->flags);
@@ -122,6 +128,7 @@ static void insert_zspage(struct page *page, struct size_class *class,
 		list_add_tail(&page->lru, &(*head)->lru);
 
 	*head = page;
+	class->zspage_count[fullness]++;
 }
 
 static void remove_zspage(struct page *page, struct size_class *class,
@@ -143,6 +150,7 @@ static void remove_zspage(struct page *page, struct size_class *class,
 					struct page, lru);
 
 	list_del_init(&page->lru);
+	class->zspage_count[fullness]--;
 }
 
 static enum fullness_group fix_fullness_group(struct zs_pool *pool,
@@ -230,30 +238,59 @@ static struct page *get_next_page(struct page *page)
 	return next;
 }
 
-/* Encode <page, obj_idx> as a single handle value */
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+/* Encode <page, obj_idx> as a single value */
+static unsigned long location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
-		return NULL;
+		return 0;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= (obj_idx & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= (obj_idx & OBJ_INDEX_MASK);
+	obj <<= OBJ_TAG_BITS;
 
-	return (void *)handle;
+	return obj;
 }
 
-/* Decode <page, obj_idx> pair from the given object handle */
-static void obj_handle_to_location(void *handle, struct page **page,
+/* Decode <page, obj_idx> pair from the given object value */
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	unsigned long hval = (unsigned long)handle;
+	obj >>= OBJ_TAG_BITS;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = obj & OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(void *handle)
+{
+	return *(unsigned long *)handle & ~(1UL << HANDLE_PIN_BIT);
+}
+
+/*
+ * Store a new object location in the handle. Callers hold the pin,
+ * and it stays held across the update.
+ */
+static void record_obj(void *handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj | (1UL << HANDLE_PIN_BIT);
+}
+
+static void pin_tag(void *handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(void *handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
 
-	*page = pfn_to_page(hval >> OBJ_INDEX_BITS);
-	*obj_idx = hval & OBJ_INDEX_MASK;
+static void unpin_tag(void *handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -330,7 +367,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
@@ -341,7 +378,7 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		 * page (if present)
 		 */
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,9 +433,9 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = (void *)location_to_obj(first_page, 0);
 	/* Maximum number of objects we can store in this zspage */
-	first_page->objects = class->zspage_order * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; /* Success */
 
@@ -425,6 +462,498 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+/*
+ * Take the object at the head of the zspage's freelist and mark it
+ * as owned by @handle. Called with class->lock held.
+ */
+static unsigned long obj_malloc(struct page *first_page,
+				struct size_class *class, void *handle)
+{
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long obj, m_objidx, m_offset;
+	void *vaddr;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	vaddr = kmap_atomic(m_page);
+	link = (struct link_free *)(vaddr + m_offset);
+	first_page->freelist = (void *)link->next;
+	link->handle = (unsigned long)handle | OBJ_ALLOCATED_TAG;
+	kunmap_atomic(vaddr);
+
+	first_page->inuse++;
+	class->objs_inuse++;
+
+	return obj;
+}
+
+/* Put the object back on its zspage's freelist. Called with class->lock held */
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+	void *vaddr;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	vaddr = kmap_atomic(f_page);
+	link = (struct link_free *)(vaddr + f_offset);
+	link->next = (unsigned long)first_page->freelist;
+	kunmap_atomic(vaddr);
+	first_page->freelist = (void *)obj;
+
+	first_page->inuse--;
+	class->objs_inuse--;
+}
+
+/* Copy a whole object, either side of which may span two pages */
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	void *s_addr, *d_addr;
+	int s_size, d_size, size;
+	int written = 0;
+
+	s_size = d_size = class->size;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	if (s_off + class->size > PAGE_SIZE)
+		s_size = PAGE_SIZE - s_off;
+	if (d_off + class->size > PAGE_SIZE)
+		d_size = PAGE_SIZE - d_off;
+
+	s_addr = kmap_atomic(s_page);
+	d_addr = kmap_atomic(d_page);
+
+	while (1) {
+		size = min(s_size, d_size);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		written += size;
+
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		s_size -= size;
+		d_off += size;
+		d_size -= size;
+
+		/* kmap_atomic() mappings nest, so release in reverse order */
+		if (s_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			kunmap_atomic(s_addr);
+			s_page = get_next_page(s_page);
+			BUG_ON(!s_page);
+			s_addr = kmap_atomic(s_page);
+			d_addr = kmap_atomic(d_page);
+			s_size = class->size - written;
+			s_off = 0;
+		}
+
+		if (d_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			d_page = get_next_page(d_page);
+			BUG_ON(!d_page);
+			d_addr = kmap_atomic(d_page);
+			d_size = class->size - written;
+			d_off = 0;
+		}
+	}
+
+	kunmap_atomic(d_addr);
+	kunmap_atomic(s_addr);
+}
+
+/*
+ * Number of zspages that could be freed if the objects of this class
+ * were packed tightly. Called with class->lock held.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_allocated, obj_wasted;
+
+	obj_allocated = (unsigned long)class->pages_allocated /
+			class->zspage_order * class->objs_per_zspage;
+	obj_wasted = obj_allocated - class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage;
+}
+
+struct zs_compact_control {
+	/* zspage objects are moved out of */
+	struct page *s_page;
+	/* sub-page and index within it to resume scanning s_page from */
+	struct page *s_cur;
+	unsigned long s_objidx;
+	/* number of objects of s_page already looked at */
+	int s_scanned;
+	/* zspage objects are moved into */
+	struct page *d_page;
+};
+
+/*
+ * Find the next allocated object of cc->s_page whose handle can be
+ * pinned. Objects that are mapped or being freed right now are
+ * skipped; they keep the source zspage alive. Returns the handle, or
+ * NULL once the zspage has been scanned completely.
+ */
+static void *find_alloced_obj(struct size_class *class,
+				struct zs_compact_control *cc,
+				unsigned long *obj)
+{
+	struct page *first_page = cc->s_page;
+	struct page *page = cc->s_cur;
+	struct link_free *link;
+	unsigned long off, head;
+	void *vaddr, *handle = NULL;
+
+	while (page && cc->s_scanned < first_page->objects) {
+		off = obj_idx_to_offset(page, cc->s_objidx, class->size);
+		if (off >= PAGE_SIZE) {
+			page = get_next_page(page);
+			cc->s_objidx = 0;
+			continue;
+		}
+
+		vaddr = kmap_atomic(page);
+		link = (struct link_free *)(vaddr + off);
+		head = link->handle;
+		kunmap_atomic(vaddr);
+
+		*obj = location_to_obj(page, cc->s_objidx);
+		cc->s_objidx++;
+		cc->s_scanned++;
+
+		if (!(head & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = (void *)(head & ~OBJ_ALLOCATED_TAG);
+		if (trypin_tag(handle))
+			break;
+		handle = NULL;
+	}
+
+	cc->s_cur = page;
+	return handle;
+}
+
+/*
+ * Move objects from cc->s_page to cc->d_page until either the source
+ * has been scanned completely (returns 0) or the destination is full
+ * (returns -ENOMEM). Called with class->lock held.
+ */
+static int migrate_zspage(struct size_class *class,
+				struct zs_compact_control *cc)
+{
+	struct page *d_page = cc->d_page;
+	unsigned long used_obj, free_obj;
+	void *handle;
+
+	while (d_page->inuse < d_page->objects) {
+		handle = find_alloced_obj(class, cc, &used_obj);
+		if (!handle)
+			return 0;
+
+		free_obj = obj_malloc(d_page, class, handle);
+		zs_object_copy(free_obj, used_obj, class);
+		record_obj(handle, free_obj);
+		unpin_tag(handle);
+		obj_free(class, used_obj);
+	}
+
+	return -ENOMEM;
+}
+
+static struct page *isolate_zspage(struct size_class *class,
+				const enum fullness_group *groups, int nr)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		page = class->fullness_list[groups[i]];
+		if (page) {
+			remove_zspage(page, class, groups[i]);
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/* Sparse zspages are the cheapest to empty */
+static struct page *isolate_source_page(struct size_class *class)
+{
+	static const enum fullness_group groups[] = {
+		ZS_ALMOST_EMPTY, ZS_ALMOST_FULL
+	};
+
+	return isolate_zspage(class, groups, ARRAY_SIZE(groups));
+}
+
+/* and full ones need the fewest objects to be filled up */
+static struct page *isolate_target_page(struct size_class *class)
+{
+	static const enum fullness_group groups[] = {
+		ZS_ALMOST_FULL, ZS_ALMOST_EMPTY
+	};
+
+	return isolate_zspage(class, groups, ARRAY_SIZE(groups));
+}
+
+/*
+ * Put an isolated zspage back on the list matching its new fullness.
+ * Empty zspages are not listed; the caller frees them.
+ */
+static enum fullness_group putback_zspage(struct size_class *class,
+						struct page *first_page)
+{
+	enum fullness_group fullness;
+
+	fullness = get_fullness_group(first_page);
+	insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+
+	return fullness;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zs_compact_control cc;
+	struct page *src_page, *dst_page;
+	unsigned long nr_freed = 0;
+
+	spin_lock(&class->lock);
+	while (zs_can_compact(class)) {
+		src_page = isolate_source_page(class);
+		if (!src_page)
+			break;
+
+		cc.s_page = src_page;
+		cc.s_cur = src_page;
+		cc.s_objidx = 0;
+		cc.s_scanned = 0;
+
+		while ((dst_page = isolate_target_page(class))) {
+			cc.d_page = dst_page;
+			if (!migrate_zspage(class, &cc))
+				break;
+			putback_zspage(class, dst_page);
+		}
+
+		/* Nothing left to fill up, so no point in going on */
+		if (!dst_page) {
+			putback_zspage(class, src_page);
+			break;
+		}
+		putback_zspage(class, dst_page);
+
+		/*
+		 * zs_can_compact() guarantees there was room for every
+		 * object of src_page, so only pinned objects can keep it
+		 * alive. Leave them be until the next run.
+		 */
+		if (putback_zspage(class, src_page) != ZS_EMPTY)
+			break;
+
+		class->pages_allocated -= class->zspage_order;
+		free_zspage(src_page);
+		nr_freed += class->zspage_order;
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return nr_freed;
+}
+
+/**
+ * zs_compact - Reclaim fragmented zspages of a pool.
+ * @pool: pool to compact
+ *
+ * For every size class, objects are moved out of sparsely used zspages
+ * into fuller ones, and the zspages emptied this way are freed. Objects
+ * which are mapped at the time are left in place.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long nr_freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		nr_freed += __zs_compact(pool, &pool->size_class[i]);
+
+	atomic_long_add(nr_freed, &pool->pages_compacted);
+
+	return nr_freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	stats->pages_compacted = atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
+
+static unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		pages += zs_can_compact(class) * class->zspage_order;
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+						shrinker);
+
+	if (sc->nr_to_scan) {
+		int i;
+		unsigned long nr_freed = 0;
+
+		for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+			nr_freed += __zs_compact(pool, &pool->size_class[i]);
+			if (nr_freed >= sc->nr_to_scan)
+				break;
+		}
+		atomic_long_add(nr_freed, &pool->pages_compacted);
+	}
+
+	return min_t(unsigned long, zs_compactable_pages(pool), INT_MAX);
+}
+
+#ifdef CONFIG_ZSMALLOC_STAT
+static struct dentry *zs_stat_root;
+
+static int zs_stats_size_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long obj_allocated, obj_used, pages_used, freeable;
+	unsigned long almost_full, almost_empty;
+	unsigned long total_objs = 0, total_used_objs = 0;
+	unsigned long total_pages = 0, total_bytes = 0, total_freeable = 0;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %12s %16s %8s\n",
+			"class", "size", "almost_full", "almost_empty",
+			"obj_allocated", "obj_used", "pages_used",
+			"bytes_stored", "pages_per_zspage", "freeable");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		almost_full = class->zspage_count[ZS_ALMOST_FULL];
+		almost_empty = class->zspage_count[ZS_ALMOST_EMPTY];
+		pages_used = class->pages_allocated;
+		obj_allocated = pages_used / class->zspage_order *
+					class->objs_per_zspage;
+		obj_used = class->objs_inuse;
+		freeable = zs_can_compact(class) * class->zspage_order;
+		spin_unlock(&class->lock);
+
+		seq_printf(s, " %5u %5u %11lu %12lu %13lu %10lu %10lu %12lu %16d %8lu\n",
+			i, class->size, almost_full, almost_empty,
+			obj_allocated, obj_used, pages_used,
+			obj_used * (class->size - ZS_HANDLE_SIZE),
+			class->zspage_order, freeable);
+
+		total_objs += obj_allocated;
+		total_used_objs += obj_used;
+		total_pages += pages_used;
+		total_bytes += obj_used * (class->size - ZS_HANDLE_SIZE);
+		total_freeable += freeable;
+	}
+
+	seq_printf(s, "\n %5s %5s %11s %12s %13lu %10lu %10lu %12lu %16s %8lu\n",
+			"Total", "", "", "", total_objs, total_used_objs,
+			total_pages, total_bytes, "", total_freeable);
+
+	return 0;
+}
+
+static int zs_stats_size_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_size_show, inode->i_private);
+}
+
+static const struct file_operations zs_stat_size_ops = {
+	.open		= zs_stats_size_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	static atomic_t pool_id = ATOMIC_INIT(0);
+	char name[32];
+
+	if (!zs_stat_root)
+		return;
+
+	/* several pools may share a name, e.g. one per zram device */
+	snprintf(name, sizeof(name), "%s-%d", pool->name,
+			atomic_inc_return(&pool_id) - 1);
+	pool->stat_dentry = debugfs_create_dir(name, zs_stat_root);
+	if (IS_ERR_OR_NULL(pool->stat_dentry)) {
+		pool->stat_dentry = NULL;
+		return;
+	}
+	debugfs_create_file("classes", S_IRUGO, pool->stat_dentry, pool,
+				&zs_stat_size_ops);
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+
+static void zs_stat_init(void)
+{
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_stat_root))
+		zs_stat_root = NULL;
+}
+
+static void zs_stat_exit(void)
+{
+	debugfs_remove_recursive(zs_stat_root);
+}
+#else
+static inline void zs_pool_stat_create(struct zs_pool *pool) { }
+static inline void zs_pool_stat_destroy(struct zs_pool *pool) { }
+static inline void zs_stat_init(void) { }
+static inline void zs_stat_exit(void) { }
+#endif
 
 static int zs_cpu_notifier(struct notifier_block *nb, unsigned long action,
 				void *pcpu)
@@ -464,12 +993,23 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	zs_stat_exit();
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
+	zs_handle_cache = NULL;
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cache = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+						0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+	zs_stat_init();
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
@@ -508,12 +1048,19 @@ struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->zspage_order = get_zspage_order(size);
-
+		class->objs_per_zspage = class->zspage_order * PAGE_SIZE /
+						size;
 	}
 
 	pool->flags = flags;
 	pool->name = name;
 
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_stat_create(pool);
+
 	return pool;
 }
 EXPORT_SYMBOL_GPL(zs_create_pool);
@@ -522,6 +1069,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	unregister_shrinker(&pool->shrinker);
+	zs_pool_stat_destroy(pool);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -542,28 +1092,31 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
  * zs_malloc - Allocate block of given size from pool.
  * @pool: pool to allocate from
  * @size: size of block to allocate
- * @page: page no. that holds the object
- * @offset: location of object within page
  *
- * On success, <page, offset> identifies block allocated
- * and 0 is returned. On failure, <page, offset> is set to
- * 0 and -ENOMEM is returned.
+ * On success, a handle to the allocated object is returned; it must
+ * be mapped with zs_map_object() to access the object. On failure,
+ * NULL is returned.
  *
- * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE
+ * will fail.
  */
 void *zs_malloc(struct zs_pool *pool, size_t size)
 {
-	void *obj;
-	struct link_free *link;
+	void *handle;
+	unsigned long obj;
 	int class_idx;
 	struct size_class *class;
+	struct page *first_page;
 
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE - ZS_HANDLE_SIZE))
+		return NULL;
 
-	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+	handle = kmem_cache_alloc(zs_handle_cache,
+			pool->flags & ~(__GFP_HIGHMEM | __GFP_MOVABLE));
+	if (unlikely(!handle))
 		return NULL;
 
+	size += ZS_HANDLE_SIZE;
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -574,75 +1127,68 @@ void *zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			kmem_cache_free(zs_handle_cache, handle);
 			return NULL;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->zspage_order;
 	}
 
-	obj = first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
-
-	first_page->inuse++;
+	obj = obj_malloc(first_page, class, handle);
+	*(unsigned long *)handle = obj;
 	/* Now move the zspage to another fullness group, if required */
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, void *obj)
+void zs_free(struct zs_pool *pool, void *handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long obj, f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	/* Keeps compaction from moving the object under us */
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	/* Insert this object in containing zspage's freelist */
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
 	if (fullness == ZS_EMPTY)
 		class->pages_allocated -= class->zspage_order;
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	kmem_cache_free(zs_handle_cache, handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
 }
 EXPORT_SYMBOL_GPL(zs_free);
 
+/*
+ * The object stays pinned, and so can not be moved by compaction,
+ * until zs_unmap_object() is called.
+ */
 void *zs_map_object(struct zs_pool *pool, void *handle)
 {
 	struct page *page;
@@ -655,7 +1201,8 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	pin_tag(handle);
+	obj_to_location(handle_to_obj(handle), &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -679,7 +1226,7 @@ void *zs_map_object(struct zs_pool *pool, void *handle)
 		area->vm_addr = area->vm->addr;
 	}
 
-	return area->vm_addr + off;
+	return area->vm_addr + off + ZS_HANDLE_SIZE;
 }
 EXPORT_SYMBOL_GPL(zs_map_object);
 
@@ -695,7 +1242,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj_to_location(handle_to_obj(handle), &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -710,6 +1257,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle)
 		__flush_tlb_one((unsigned long)area->vm_addr + PAGE_SIZE);
 	}
 	put_cpu_var(zs_map_area);
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -17,6 +17,11 @@
 
 struct zs_pool;
 
+struct zs_pool_stats {
+	/* Number of pages freed by compaction so far */
+	unsigned long pages_compacted;
+};
+
 struct zs_pool *zs_create_pool(const char *name, gfp_t flags);
 void zs_destroy_pool(struct zs_pool *pool);
 
@@ -28,4 +33,7 @@ void zs_unmap_object(struct zs_pool *pool, void *handle);
 
 u64 zs_get_total_size_bytes(struct zs_pool *pool);
 
+unsigned long zs_compact(struct zs_pool *pool);
+void zs_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
 #endif
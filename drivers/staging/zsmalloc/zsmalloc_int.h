@@ -14,6 +14,7 @@
 #define _ZS_MALLOC_INT_H_
 
 #include <linux/kernel.h>
+#include <linux/shrinker.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
 
@@ -34,13 +35,19 @@
 
 /*
  * Object location (<PFN>, <obj_idx>) is encoded as
- * as single (void *) handle value.
+ * as single unsigned long value, shifted left by OBJ_TAG_BITS.
  *
  * Note that object index <obj_idx> is relative to system
  * page <PFN> it is stored in, so for each sub-page belonging
  * to a zspage, obj_idx starts with 0.
  *
  * This is made more complicated by various memory models and PAE.
+ *
+ * Handles given out by zs_malloc() do not carry the location
+ * directly: a handle points to a word holding the encoded location,
+ * so objects can be moved around by compaction without the user
+ * noticing. The low bit of that word (HANDLE_PIN_BIT) is a bit lock
+ * held while the object is mapped, freed or migrated.
  */
 
 #ifndef MAX_PHYSMEM_BITS
@@ -55,9 +62,20 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+#define OBJ_TAG_BITS	1
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
+/* Set in the header of allocated objects, clear in free ones */
+#define OBJ_ALLOCATED_TAG	1
+#define HANDLE_PIN_BIT		0
+
+/*
+ * Every allocated object is prefixed by its handle so that compaction
+ * can find the handle to update when it moves the object.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
 /* ZS_MIN_ALLOC_SIZE must be multiple of ZS_ALIGN */
 #define ZS_MIN_ALLOC_SIZE \
@@ -125,24 +143,34 @@ struct size_class {
 
 	/* Number of PAGE_SIZE sized pages to combine to form a 'zspage' */
 	int zspage_order;
+	/* Number of objects that fit in one zspage */
+	int objs_per_zspage;
 
 	spinlock_t lock;
 
 	/* stats */
 	u64 pages_allocated;
+	unsigned long objs_inuse;
+	unsigned long zspage_count[_ZS_NR_FULLNESS_GROUPS];
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
 };
 
 /*
- * Placed within free objects to form a singly linked list.
- * For every zspage, first_page->freelist gives head of this list.
+ * Placed at the start of every object. Free objects use it to form
+ * a singly linked list (first_page->freelist gives head of this list),
+ * allocated objects keep their handle there, tagged with
+ * OBJ_ALLOCATED_TAG.
  *
  * This must be power of 2 and less than or equal to ZS_ALIGN
  */
 struct link_free {
-	/* Handle of next free chunk (encodes <PFN, obj_idx>) */
-	void *next;
+	union {
+		/* Location of next free chunk (encodes <PFN, obj_idx>) */
+		unsigned long next;
+		/* Handle of allocated object */
+		unsigned long handle;
+	};
 };
 
 struct zs_pool {
@@ -150,6 +178,14 @@ struct zs_pool {
 
 	gfp_t flags;	/* allocation flags used when growing pool */
 	const char *name;
+
+	/* Compaction is also kicked from memory reclaim */
+	struct shrinker shrinker;
+	atomic_long_t pages_compacted;
+
+#ifdef CONFIG_ZSMALLOC_STAT
+	struct dentry *stat_dentry;
+#endif
 };
 
 #endif
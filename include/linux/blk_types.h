@@ -114,6 +114,7 @@ enum rq_flag_bits {
 	__REQ_IO_STAT,		
 	__REQ_MIXED_MERGE,	
 	__REQ_SANITIZE,		
+	__REQ_URGENT,		/* driver should serve it ahead of all others */
 	__REQ_NR_BITS,		
 };
 
@@ -126,6 +127,7 @@ enum rq_flag_bits {
 #define REQ_PRIO		(1 << __REQ_PRIO)
 #define REQ_DISCARD		(1 << __REQ_DISCARD)
 #define REQ_SANITIZE		(1 << __REQ_SANITIZE)
+#define REQ_URGENT		(1 << __REQ_URGENT)
 #define REQ_NOIDLE		(1 << __REQ_NOIDLE)
 
 #define REQ_FAILFAST_MASK \
@@ -133,7 +135,7 @@ enum rq_flag_bits {
 #define REQ_COMMON_MASK \
 	(REQ_WRITE | REQ_FAILFAST_MASK | REQ_SYNC | REQ_META | REQ_PRIO | \
 	 REQ_DISCARD | REQ_NOIDLE | REQ_FLUSH | REQ_FUA | REQ_SECURE | \
-	 REQ_SANITIZE)
+	 REQ_SANITIZE | REQ_URGENT)
 #define REQ_CLONE_MASK		REQ_COMMON_MASK
 
 #define REQ_RAHEAD		(1 << __REQ_RAHEAD)
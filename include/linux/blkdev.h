@@ -29,6 +29,7 @@ struct request_queue;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
+struct blk_latency_hist;
 struct request;
 struct sg_io_hdr;
 struct bsg_job;
@@ -105,6 +106,11 @@ struct request {
 #ifdef CONFIG_BLK_CGROUP
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    
+#endif
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	u64 lat_queue_ns;
+	u64 lat_start_ns;
+	unsigned int lat_bytes;
 #endif
 	unsigned short nr_phys_segments;
 #if defined(CONFIG_BLK_DEV_INTEGRITY)
@@ -162,6 +168,7 @@ typedef void (request_fn_proc) (struct request_queue *q);
 typedef void (make_request_fn) (struct request_queue *q, struct bio *bio);
 typedef int (prep_rq_fn) (struct request_queue *, struct request *);
 typedef void (unprep_rq_fn) (struct request_queue *, struct request *);
+typedef void (urgent_request_fn) (struct request_queue *q);
 
 struct bio_vec;
 struct bvec_merge_data {
@@ -243,6 +250,7 @@ struct request_queue {
 	rq_timed_out_fn		*rq_timed_out_fn;
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
+	urgent_request_fn	*urgent_request_fn;
 
 	sector_t		end_sector;
 	struct request		*boundary_rq;
@@ -293,6 +301,9 @@ struct request_queue {
 	int			node;
 #ifdef CONFIG_BLK_DEV_IO_TRACE
 	struct blk_trace	*blk_trace;
+#endif
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	struct blk_latency_hist	*latency_hist;
 #endif
 	unsigned int		flush_flags;
 	unsigned int		flush_not_queueable:1;
@@ -715,6 +726,8 @@ extern void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn);
 extern void blk_queue_segment_boundary(struct request_queue *, unsigned long);
 extern void blk_queue_prep_rq(struct request_queue *, prep_rq_fn *pfn);
 extern void blk_queue_unprep_rq(struct request_queue *, unprep_rq_fn *ufn);
+extern void blk_queue_urgent_request(struct request_queue *,
+				     urgent_request_fn *fn);
 extern void blk_queue_merge_bvec(struct request_queue *, merge_bvec_fn *);
 extern void blk_queue_dma_alignment(struct request_queue *, int);
 extern void blk_queue_update_dma_alignment(struct request_queue *, int);
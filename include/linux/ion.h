@@ -28,6 +28,7 @@ enum ion_heap_type {
 	ION_HEAP_TYPE_CARVEOUT,
 	ION_HEAP_TYPE_IOMMU,
 	ION_HEAP_TYPE_CP,
+	ION_HEAP_TYPE_CMA,
 	ION_HEAP_TYPE_CUSTOM, 
 	ION_NUM_HEAPS,
 };
@@ -36,6 +37,7 @@ enum ion_heap_type {
 #define ION_HEAP_SYSTEM_CONTIG_MASK	(1 << ION_HEAP_TYPE_SYSTEM_CONTIG)
 #define ION_HEAP_CARVEOUT_MASK		(1 << ION_HEAP_TYPE_CARVEOUT)
 #define ION_HEAP_CP_MASK		(1 << ION_HEAP_TYPE_CP)
+#define ION_HEAP_CMA_MASK		(1 << ION_HEAP_TYPE_CMA)
 
 
 
@@ -149,6 +151,14 @@ struct ion_co_heap_pdata {
 	void *(*setup_region)(void);
 };
 
+/*
+ * extra_data of an ION_HEAP_TYPE_CMA heap.  The board reserves the
+ * contiguous area for @dev with dma_declare_contiguous() at reserve time.
+ */
+struct ion_cma_heap_pdata {
+	struct device *dev;
+};
+
 struct ion_platform_data {
 	unsigned int has_outer_cache;
 	int nr;
@@ -224,6 +224,7 @@ enum mmc_packed_stop_reasons {
 	EMPTY_QUEUE,
 	REL_WRITE,
 	THRESHOLD,
+	URGENT_REQUEST,
 	MAX_REASONS,
 };
 
@@ -235,6 +236,76 @@ struct mmc_wr_pack_stats {
 	bool print_in_read;
 };
 
+struct mmc_pack_size_stats {
+	u32 nr;			/* packed commands of this size completed */
+	u64 bytes;
+	u64 us;			/* time from issue to completion */
+};
+
+/*
+ * Adaptive write packing: completed writes are accounted by the number
+ * of requests they packed ([1] for unpacked ones), and every
+ * MMC_PACK_ADAPT_INTERVAL completions the block driver retunes the
+ * number of writes needed to start packing and the largest pack.
+ */
+#define MMC_PACK_ADAPT_INTERVAL		64
+#define MMC_PACK_LATENCY_TARGET_US	30000
+
+struct mmc_pack_policy {
+	spinlock_t lock;
+	u32 adaptive;
+	u32 latency_target_us;	/* longest a pack should keep the card */
+	u8 max_packed;		/* <= ext_csd.max_packed_writes */
+	int start_thresh;	/* last num_wr_reqs_to_start_packing set */
+	u32 adjustments;
+	u32 completions;	/* since the last adjustment */
+	u64 wr_reqs;		/* write requests completed */
+	u64 packed_reqs;	/* of which were part of a pack */
+	struct mmc_pack_size_stats *size;
+};
+
+/*
+ * Background work done while the block queue is idle: BKOPS started
+ * after idle_ms without I/O, and discards held back while other I/O is
+ * queued.  The times are accurate to MMC_IDLE_BKOPS_POLL_MS.
+ */
+#define MMC_IDLE_BKOPS_MS		2000
+#define MMC_IDLE_BKOPS_POLL_MS		100
+#define MMC_IDLE_BKOPS_POLL_RETRIES	10
+#define MMC_DISCARD_BATCH		8
+#define MMC_DISCARD_MAX_DELAY_MS	100
+
+struct mmc_idle_bkops {
+	spinlock_t lock;
+	u32 idle_ms;		/* 0 disables idle BKOPS */
+	u32 screen_off_only;
+	u32 discard_batch;	/* 0 disables holding discards */
+	u32 discard_max_delay_ms;
+	u32 starts;
+	u32 completed;		/* finished while still idle */
+	u32 interrupted;	/* stopped with HPI for new I/O */
+	u64 hidden_us;		/* BKOPS time the queue was idle for */
+	u64 hpi_us;		/* time spent stopping it */
+	u32 discards_held;
+	u32 discard_flushes;
+	ktime_t start;		/* of the idle BKOPS running, or 0 */
+	u32 poll_errors;	/* CMD13 failures in a row while polling */
+};
+
+/* Urgent request latency buckets: < 1, 2, 4 ... 64 ms, and >= 64 ms */
+#define MMC_URGENT_HIST_BUCKETS	8
+
+struct mmc_urgent_stats {
+	spinlock_t lock;
+	u32 queued;		/* urgent requests queued */
+	u32 served;		/* urgent requests completed */
+	u32 preempted;		/* writes put back to serve one first */
+	u32 packs_cut;		/* packed writes cut short for one */
+	u64 total_us;
+	u32 max_us;
+	u32 hist[MMC_URGENT_HIST_BUCKETS];
+};
+
 struct mmc_card {
 	struct mmc_host		*host;		
 	struct device		dev;		
@@ -322,6 +393,9 @@ struct mmc_card {
 	s8			speed_class; 
 
 	struct mmc_wr_pack_stats wr_pack_stats; 
+	struct mmc_urgent_stats urgent_stats;
+	struct mmc_pack_policy pack_policy;
+	struct mmc_idle_bkops idle_bkops;
 };
 
 static inline void mmc_part_add(struct mmc_card *card, unsigned int size,
@@ -125,6 +125,8 @@ extern int mmc_wait_for_app_cmd(struct mmc_host *, struct mmc_card *,
 extern int mmc_switch(struct mmc_card *, u8, u8, u8, unsigned int);
 extern int mmc_send_ext_csd(struct mmc_card *card, u8 *ext_csd);
 extern void mmc_start_bkops(struct mmc_card *card);
+extern int mmc_start_idle_bkops(struct mmc_card *card);
+extern int mmc_poll_idle_bkops(struct mmc_card *card);
 #define MMC_ERASE_ARG		0x00000000
 #define MMC_TRIM_ARG		0x00000001
 #define MMC_DISCARD_ARG		0x00000003
@@ -123,6 +123,12 @@ struct mmc_async_req {
 	struct mmc_request	*mrq;
 	ktime_t rq_stime;
 	int (*err_check) (struct mmc_card *, struct mmc_async_req *);
+	/*
+	 * Checked once the previous request is done, before this one is
+	 * started.  Returning true keeps it from being started, so that
+	 * the caller can issue something more urgent first.
+	 */
+	bool (*should_defer) (struct mmc_card *, struct mmc_async_req *);
 };
 
 struct mmc_hotplug {
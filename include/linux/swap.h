@@ -137,6 +137,10 @@ struct swap_info_struct {
 	struct block_device *bdev;	
 	struct file *swap_file;		
 	unsigned int old_block_size;	
+#ifdef CONFIG_FRONTSWAP
+	unsigned long *frontswap_map;	/* frontswap in-use, one bit per page */
+	atomic_t frontswap_pages;	/* frontswap pages in-use counter */
+#endif
 };
 
 struct swap_list_t {
@@ -228,13 +232,24 @@ static inline void scan_unevictable_unregister_node(struct node *node)
 
 extern int kswapd_run(int nid);
 extern void kswapd_stop(int nid);
+
+#define MEM_CGROUP_RECLAIM_WEIGHT_MIN		1
+#define MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT	100
+#define MEM_CGROUP_RECLAIM_WEIGHT_MAX		1000
+
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 extern int mem_cgroup_swappiness(struct mem_cgroup *mem);
+extern int mem_cgroup_reclaim_weight(struct mem_cgroup *mem);
 #else
 static inline int mem_cgroup_swappiness(struct mem_cgroup *mem)
 {
 	return vm_swappiness;
 }
+
+static inline int mem_cgroup_reclaim_weight(struct mem_cgroup *mem)
+{
+	return MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT;
+}
 #endif
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
 extern void mem_cgroup_uncharge_swap(swp_entry_t ent);
@@ -246,6 +261,9 @@ static inline void mem_cgroup_uncharge_swap(swp_entry_t ent)
 #ifdef CONFIG_SWAP
 extern int swap_readpage(struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc,
+	void (*end_write_func)(struct bio *, int));
+extern void end_swap_bio_write(struct bio *bio, int err);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 extern struct address_space swapper_space;
@@ -253,6 +271,7 @@ extern struct address_space swapper_space;
 extern void show_swap_cache_info(void);
 extern int add_to_swap(struct page *);
 extern int add_to_swap_cache(struct page *, swp_entry_t, gfp_t);
+extern int __add_to_swap_cache(struct page *page, swp_entry_t entry);
 extern void __delete_from_swap_cache(struct page *);
 extern void delete_from_swap_cache(struct page *);
 extern void free_page_and_swap_cache(struct page *);
@@ -49,6 +49,7 @@
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
 #include <linux/oom.h>
+#include <linux/vmpressure.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/tcp_memcontrol.h>
@@ -273,6 +274,11 @@ struct mem_cgroup {
 	atomic_t	refcnt;
 
 	int	swappiness;
+	/*
+	 * Relative pressure global reclaim puts on this group's LRUs, in
+	 * percent of what an unweighted group would see.
+	 */
+	int	reclaim_weight;
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
@@ -290,6 +296,8 @@ struct mem_cgroup {
 
 	/* For oom notifier event fd */
 	struct list_head oom_notify;
+	/* For memory.pressure_level notifications */
+	struct vmpressure vmpressure;
 
 	/*
 	 * Should we move charges of a task when a task is moved into this
@@ -832,6 +840,23 @@ struct mem_cgroup *mem_cgroup_from_cont(struct cgroup *cont)
 				css);
 }
 
+struct vmpressure *memcg_to_vmpressure(struct mem_cgroup *memcg)
+{
+	if (!memcg)
+		memcg = root_mem_cgroup;
+	return &memcg->vmpressure;
+}
+
+struct cgroup_subsys_state *vmpressure_to_css(struct vmpressure *vmpr)
+{
+	return &container_of(vmpr, struct mem_cgroup, vmpressure)->css;
+}
+
+struct vmpressure *css_to_vmpressure(struct cgroup_subsys_state *css)
+{
+	return &container_of(css, struct mem_cgroup, css)->vmpressure;
+}
+
 struct mem_cgroup *mem_cgroup_from_task(struct task_struct *p)
 {
 	/*
@@ -1292,6 +1317,15 @@ int mem_cgroup_swappiness(struct mem_cgroup *memcg)
 	return memcg->swappiness;
 }
 
+int mem_cgroup_reclaim_weight(struct mem_cgroup *memcg)
+{
+	/* no memcg (disabled at boot) or root ? */
+	if (!memcg || memcg->css.cgroup->parent == NULL)
+		return MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT;
+
+	return memcg->reclaim_weight;
+}
+
 /*
  * memcg->moving_account is used for checking possibility that some thread is
  * calling move_account(). When a thread on CPU-A starts moving pages under
@@ -4273,6 +4307,32 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+static u64 mem_cgroup_reclaim_weight_read(struct cgroup *cgrp,
+					  struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	return mem_cgroup_reclaim_weight(memcg);
+}
+
+static int mem_cgroup_reclaim_weight_write(struct cgroup *cgrp,
+					   struct cftype *cft, u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+
+	if (val < MEM_CGROUP_RECLAIM_WEIGHT_MIN ||
+	    val > MEM_CGROUP_RECLAIM_WEIGHT_MAX)
+		return -EINVAL;
+
+	/* The root group is the reference all others are weighted against. */
+	if (cgrp->parent == NULL)
+		return -EINVAL;
+
+	memcg->reclaim_weight = val;
+
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -4701,6 +4761,11 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_swappiness_read,
 		.write_u64 = mem_cgroup_swappiness_write,
 	},
+	{
+		.name = "reclaim_weight",
+		.read_u64 = mem_cgroup_reclaim_weight_read,
+		.write_u64 = mem_cgroup_reclaim_weight_write,
+	},
 	{
 		.name = "move_charge_at_immigrate",
 		.read_u64 = mem_cgroup_move_charge_read,
@@ -4714,6 +4779,11 @@ static struct cftype mem_cgroup_files[] = {
 		.unregister_event = mem_cgroup_oom_unregister_event,
 		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
 	},
+	{
+		.name = "pressure_level",
+		.register_event = vmpressure_register_event,
+		.unregister_event = vmpressure_unregister_event,
+	},
 #ifdef CONFIG_NUMA
 	{
 		.name = "numa_stat",
@@ -5009,9 +5079,12 @@ mem_cgroup_create(struct cgroup *cont)
 	}
 	memcg->last_scanned_node = MAX_NUMNODES;
 	INIT_LIST_HEAD(&memcg->oom_notify);
+	vmpressure_init(&memcg->vmpressure);
 
-	if (parent)
+	if (parent) {
 		memcg->swappiness = mem_cgroup_swappiness(parent);
+		memcg->reclaim_weight = mem_cgroup_reclaim_weight(parent);
+	}
 	atomic_set(&memcg->refcnt, 1);
 	memcg->move_charge_at_immigrate = 0;
 	mutex_init(&memcg->thresholds_lock);
@@ -5034,6 +5107,7 @@ static void mem_cgroup_destroy(struct cgroup *cont)
 	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
 
 	kmem_cgroup_destroy(cont);
+	vmpressure_cleanup(&memcg->vmpressure);
 
 	mem_cgroup_put(memcg);
 }
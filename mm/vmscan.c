@@ -41,6 +41,7 @@
 #include <linux/sysctl.h>
 #include <linux/oom.h>
 #include <linux/prefetch.h>
+#include <linux/vmpressure.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -1381,6 +1382,18 @@ static int vmscan_swappiness(struct mem_cgroup_zone *mz,
 	return mem_cgroup_swappiness(mz->mem_cgroup);
 }
 
+/*
+ * Only global reclaim is weighted: it is the one that has to choose
+ * between the groups, while limit reclaim works on a single hierarchy.
+ */
+static int vmscan_reclaim_weight(struct mem_cgroup_zone *mz,
+				 struct scan_control *sc)
+{
+	if (!global_reclaim(sc))
+		return MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT;
+	return mem_cgroup_reclaim_weight(mz->mem_cgroup);
+}
+
 static void get_scan_count(struct mem_cgroup_zone *mz, struct scan_control *sc,
 			   unsigned long *nr, int priority)
 {
@@ -1391,6 +1404,7 @@ static void get_scan_count(struct mem_cgroup_zone *mz, struct scan_control *sc,
 	u64 fraction[2], denominator;
 	enum lru_list lru;
 	int noswap = 0;
+	int weight = vmscan_reclaim_weight(mz, sc);
 	bool force_scan = false;
 
 	if (current_is_kswapd() && mz->zone->all_unreclaimable)
@@ -1458,6 +1472,15 @@ out:
 				scan = SWAP_CLUSTER_MAX;
 			scan = div64_u64(scan * fraction[file], denominator);
 		}
+		/*
+		 * Scale the pressure by the group's reclaim weight, except
+		 * at priority 0, where every group is scanned in full so
+		 * that a low weight can never make a group unreclaimable.
+		 */
+		if (priority && weight != MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT) {
+			scan = scan * weight / MEM_CGROUP_RECLAIM_WEIGHT_DEFAULT;
+			scan = min(scan, zone_nr_lru_pages(mz, lru));
+		}
 		nr[lru] = scan;
 	}
 }
@@ -1554,6 +1577,8 @@ static void shrink_zone(int priority, struct zone *zone,
 		.zone = zone,
 		.priority = priority,
 	};
+	unsigned long nr_reclaimed = sc->nr_reclaimed;
+	unsigned long nr_scanned = sc->nr_scanned;
 	struct mem_cgroup *memcg;
 
 	memcg = mem_cgroup_iter(root, NULL, &reclaim);
@@ -1570,6 +1595,10 @@ static void shrink_zone(int priority, struct zone *zone,
 		}
 		memcg = mem_cgroup_iter(root, memcg, &reclaim);
 	} while (memcg);
+
+	vmpressure(sc->gfp_mask, sc->target_mem_cgroup,
+		   sc->nr_scanned - nr_scanned,
+		   sc->nr_reclaimed - nr_reclaimed);
 }
 
 static inline bool compaction_ready(struct zone *zone, struct scan_control *sc)
@@ -1697,6 +1726,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		count_vm_event(ALLOCSTALL);
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
+		vmpressure_prio(sc->gfp_mask, sc->target_mem_cgroup, priority);
 		sc->nr_scanned = 0;
 		if (!priority)
 			disable_swap_token(sc->target_mem_cgroup);
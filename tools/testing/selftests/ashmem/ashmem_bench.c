@@ -0,0 +1,273 @@
+/*
+ * ashmem_bench: pin/unpin throughput of ashmem from concurrent processes.
+ *
+ * For 1, 2, 4, ... processes up to -p, every process creates its own
+ * ashmem area, maps and touches it, and then for the given time unpins
+ * and re-pins page ranges of it the way a cache of decoded images would.
+ * The total number of pin/unpin pairs per second is reported, with the
+ * share of pins that found their range purged.  With one area per
+ * process, throughput should scale with the number of processes.
+ *
+ * With -r (needs CAP_SYS_ADMIN), another process keeps purging all
+ * unpinned ranges meanwhile, to check that reclaim does not stall
+ * pinning, and that pinned pages are never lost: every process checks
+ * that the pages it keeps pinned still hold what it wrote.
+ *
+ * Usage: ashmem_bench [-d device] [-p max_procs] [-s seconds]
+ *			[-k area_kbytes] [-r]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* From include/linux/ashmem.h */
+struct ashmem_pin {
+	uint32_t offset;
+	uint32_t len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+
+#define ASHMEM_WAS_PURGED	1
+
+#define PAGE_SZ			4096
+#define PAGES_PER_RANGE		4
+
+static const char *device = "/dev/ashmem";
+static size_t area_bytes = 1 << 20;
+static int seconds = 2;
+
+struct result {
+	uint64_t ops;
+	uint64_t purged;
+	uint64_t errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The first range of the area stays pinned and is checked at the end;
+ * the others are cycled through unpin and pin.
+ */
+static void worker(int id, struct result *res)
+{
+	size_t nr_ranges = area_bytes / (PAGE_SZ * PAGES_PER_RANGE);
+	size_t range_len = PAGE_SZ * PAGES_PER_RANGE;
+	uint64_t end = now_ns() + (uint64_t)seconds * 1000000000ULL;
+	uint32_t x = 2654435761u * (id + 1);
+	unsigned char *p;
+	size_t i;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0 || ioctl(fd, ASHMEM_SET_SIZE, area_bytes)) {
+		res->errors++;
+		return;
+	}
+	p = mmap(NULL, area_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		res->errors++;
+		close(fd);
+		return;
+	}
+	memset(p, id + 1, area_bytes);
+
+	while (now_ns() < end) {
+		int n;
+
+		for (n = 0; n < 256; n++) {
+			struct ashmem_pin pin;
+			int ret;
+
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			pin.offset = (1 + x % (nr_ranges - 1)) * range_len;
+			pin.len = range_len;
+
+			if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0) {
+				res->errors++;
+				continue;
+			}
+			ret = ioctl(fd, ASHMEM_PIN, &pin);
+			if (ret < 0)
+				res->errors++;
+			else if (ret == ASHMEM_WAS_PURGED)
+				res->purged++;
+			res->ops++;
+		}
+	}
+
+	for (i = 0; i < range_len; i++) {
+		if (p[i] != (unsigned char)(id + 1)) {
+			res->errors++;
+			break;
+		}
+	}
+
+	munmap(p, area_bytes);
+	close(fd);
+}
+
+static void purger(void)
+{
+	int fd = open(device, O_RDWR);
+
+	if (fd < 0)
+		_exit(1);
+	for (;;) {
+		ioctl(fd, ASHMEM_PURGE_ALL_CACHES);
+		usleep(1000);
+	}
+}
+
+/* Returns 0, or -1 if a process could not be started. */
+static int run(int nr_procs, int reclaim, struct result *total)
+{
+	struct result *res;
+	pid_t pids[nr_procs];
+	pid_t purge_pid = 0;
+	int i;
+
+	res = mmap(NULL, sizeof(*res) * nr_procs, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		return -1;
+	memset(res, 0, sizeof(*res) * nr_procs);
+
+	if (reclaim) {
+		purge_pid = fork();
+		if (purge_pid < 0)
+			return -1;
+		if (!purge_pid)
+			purger();
+	}
+
+	for (i = 0; i < nr_procs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			return -1;
+		if (!pids[i]) {
+			worker(i, &res[i]);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < nr_procs; i++)
+		waitpid(pids[i], NULL, 0);
+	if (purge_pid) {
+		kill(purge_pid, SIGKILL);
+		waitpid(purge_pid, NULL, 0);
+	}
+
+	memset(total, 0, sizeof(*total));
+	for (i = 0; i < nr_procs; i++) {
+		total->ops += res[i].ops;
+		total->purged += res[i].purged;
+		total->errors += res[i].errors;
+	}
+	munmap(res, sizeof(*res) * nr_procs);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int max_procs = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	uint64_t errors = 0;
+	double base = 0;
+	int reclaim = 0;
+	int fd, opt, n;
+
+	while ((opt = getopt(argc, argv, "d:p:s:k:r")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			max_procs = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'k':
+			area_bytes = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'r':
+			reclaim = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-p max_procs] "
+				"[-s seconds] [-k area_kbytes] [-r]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (max_procs < 1)
+		max_procs = 1;
+	if (seconds < 1)
+		seconds = 1;
+	if (area_bytes < 2 * PAGE_SZ * PAGES_PER_RANGE)
+		area_bytes = 2 * PAGE_SZ * PAGES_PER_RANGE;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		printf("ashmem_bench: %s not available (%s), skipping\n",
+		       device, strerror(errno));
+		return 0;
+	}
+	close(fd);
+
+	printf("ashmem_bench: %zu KB per process, %d s per run%s\n",
+	       area_bytes >> 10, seconds, reclaim ? ", purging" : "");
+	printf("procs   pin+unpin/s  scaling  purged\n");
+	for (n = 1; ; n *= 2) {
+		struct result total;
+		double rate;
+
+		if (n > max_procs)
+			n = max_procs;
+
+		if (run(n, reclaim, &total)) {
+			printf("ashmem_bench: fork failed: %s\n",
+			       strerror(errno));
+			return 1;
+		}
+		rate = (double)total.ops / seconds;
+		if (n == 1)
+			base = rate;
+		printf("%5d %13.0f %7.2fx %6.2f%%\n", n, rate, rate / base,
+		       total.ops ? 100.0 * total.purged / total.ops : 0.0);
+		errors += total.errors;
+		if (n == max_procs)
+			break;
+	}
+
+	if (errors) {
+		printf("ashmem_bench: %llu errors or lost pinned pages\n",
+		       (unsigned long long)errors);
+		printf("ashmem_bench: FAIL\n");
+		return 1;
+	}
+	printf("ashmem_bench: PASS\n");
+	return 0;
+}
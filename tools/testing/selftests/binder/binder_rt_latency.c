@@ -0,0 +1,290 @@
+/*
+ * binder_rt_latency: worst-case call latency from an RT caller.
+ *
+ * A SCHED_FIFO client makes synchronous calls into a context manager
+ * whose looper threads run SCHED_NORMAL, while CPU hogs keep every CPU
+ * the test runs on busy.  The server burns a little CPU per call and
+ * reports the scheduling policy it handled the call with.  With
+ * priority inheritance the handler runs SCHED_FIFO and the hogs cannot
+ * delay it, so the test fails if any call was served at another policy
+ * and reports average, 99th percentile and maximum latency.
+ *
+ * Everything is pinned to one CPU by default so that the hogs really
+ * compete with the handler.
+ *
+ * Usage: binder_rt_latency [-n calls] [-H hogs] [-w work_us] [-c cpu]
+ */
+
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "binder_test.h"
+
+static int nr_calls = 2000;
+static int nr_hogs = 2;
+static int work_us = 50;
+static int cpu = 0;
+
+static struct binder_ctx ctx;
+
+static void pin(void)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void burn(int us)
+{
+	uint64_t end = now_ns() + (uint64_t)us * 1000;
+
+	while (now_ns() < end)
+		;
+}
+
+static void run_hog(void)
+{
+	pin();
+	for (;;)
+		;
+}
+
+/* ---- server ---- */
+
+static void run_server(void)
+{
+	uint32_t rbuf[64];
+	uint32_t reply;
+	struct binder_cmdbuf cb;
+
+	pin();
+	cmdbuf_reset(&cb);
+	cmdbuf_cmd(&cb, BC_ENTER_LOOPER);
+	for (;;) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+
+		if (binder_write_read(ctx.fd, cb.data, cb.len, rbuf, &rlen))
+			exit(1);
+		cmdbuf_reset(&cb);
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			if (cmd == BR_TRANSACTION) {
+				struct binder_transaction_data *tr = (void *)ptr;
+
+				burn(work_us);
+				reply = sched_getscheduler(0);
+				cmdbuf_free_buffer(&cb, tr->data.ptr.buffer);
+				cmdbuf_txn(&cb, BC_REPLY, 0, 0, 0,
+					   &reply, sizeof(reply), NULL, 0);
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+}
+
+/* ---- client ---- */
+
+/* Returns the policy the server saw, or -1 on failure. */
+static int client_call(void)
+{
+	struct binder_cmdbuf cb;
+	uint32_t rbuf[64];
+	uint32_t seq = 0;
+	int policy = -1, got_reply = 0;
+
+	cmdbuf_reset(&cb);
+	cmdbuf_txn(&cb, BC_TRANSACTION, 0, 1, 0, &seq, sizeof(seq), NULL, 0);
+	while (!got_reply) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+
+		if (binder_write_read(ctx.fd, cb.data, cb.len, rbuf, &rlen))
+			return -1;
+		cmdbuf_reset(&cb);
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_REPLY: {
+				struct binder_transaction_data *tr = (void *)ptr;
+
+				got_reply = 1;
+				if (tr->data_size == sizeof(uint32_t))
+					policy = *(const uint32_t *)tr->data.ptr.buffer;
+				cmdbuf_free_buffer(&cb, tr->data.ptr.buffer);
+				break;
+			}
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+			case BR_ERROR:
+				return -1;
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	if (cb.len && binder_write(ctx.fd, cb.data, cb.len))
+		return -1;
+	return policy;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int run_client(void)
+{
+	struct sched_param param = { .sched_priority = 50 };
+	uint64_t *lat, total = 0;
+	int i, policy, not_inherited = 0;
+
+	if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+		printf("binder_rt_latency: cannot use SCHED_FIFO (%s), "
+		       "skipping\n", strerror(errno));
+		return 0;
+	}
+	pin();
+
+	lat = calloc(nr_calls, sizeof(*lat));
+	if (!lat)
+		return 1;
+	for (i = 0; i < nr_calls; i++) {
+		uint64_t start = now_ns();
+
+		policy = client_call();
+		lat[i] = now_ns() - start;
+		if (policy < 0) {
+			printf("binder_rt_latency: FAIL (call %d failed)\n", i);
+			return 1;
+		}
+		if (policy != SCHED_FIFO)
+			not_inherited++;
+		total += lat[i];
+	}
+	qsort(lat, nr_calls, sizeof(*lat), cmp_u64);
+
+	printf("binder_rt_latency: %d calls, %d hogs, %d us work on cpu %d\n",
+	       nr_calls, nr_hogs, work_us, cpu);
+	printf("  latency avg %llu us p99 %llu us max %llu us\n",
+	       (unsigned long long)(total / nr_calls / 1000),
+	       (unsigned long long)(lat[nr_calls * 99 / 100] / 1000),
+	       (unsigned long long)(lat[nr_calls - 1] / 1000));
+	if (not_inherited) {
+		printf("binder_rt_latency: FAIL (%d calls not handled at "
+		       "SCHED_FIFO)\n", not_inherited);
+		return 1;
+	}
+	printf("binder_rt_latency: PASS\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	pid_t server, *hogs;
+	int i, opt, pipefd[2], ret;
+	char c;
+
+	while ((opt = getopt(argc, argv, "n:H:w:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_calls = atoi(optarg);
+			break;
+		case 'H':
+			nr_hogs = atoi(optarg);
+			break;
+		case 'w':
+			work_us = atoi(optarg);
+			break;
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n calls] [-H hogs] "
+				"[-w work_us] [-c cpu]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_calls < 1)
+		nr_calls = 1;
+
+	if (access(BINDER_DEV, R_OK | W_OK)) {
+		printf("binder_rt_latency: %s not available, skipping\n",
+		       BINDER_DEV);
+		return 0;
+	}
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 1;
+	}
+	server = fork();
+	if (server == 0) {
+		close(pipefd[0]);
+		if (binder_ctx_open(&ctx))
+			c = 'E';
+		else if (ioctl(ctx.fd, BINDER_SET_CONTEXT_MGR, 0))
+			c = errno == EBUSY || errno == EPERM ? 'B' : 'E';
+		else
+			c = 'R';
+		if (write(pipefd[1], &c, 1) != 1 || c != 'R')
+			_exit(1);
+		close(pipefd[1]);
+		run_server();
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1 || c != 'R') {
+		waitpid(server, NULL, 0);
+		if (c == 'B') {
+			printf("binder_rt_latency: context manager already "
+			       "registered, skipping\n");
+			return 0;
+		}
+		fprintf(stderr, "binder_rt_latency: server setup failed\n");
+		return 1;
+	}
+	close(pipefd[0]);
+
+	hogs = calloc(nr_hogs > 0 ? nr_hogs : 1, sizeof(*hogs));
+	for (i = 0; i < nr_hogs; i++) {
+		hogs[i] = fork();
+		if (hogs[i] == 0)
+			run_hog();
+	}
+
+	ret = binder_ctx_open(&ctx);
+	if (ret) {
+		fprintf(stderr, "binder_rt_latency: open: %s\n",
+			strerror(-ret));
+		ret = 1;
+	} else {
+		ret = run_client();
+		binder_ctx_close(&ctx);
+	}
+
+	for (i = 0; i < nr_hogs; i++) {
+		kill(hogs[i], SIGKILL);
+		waitpid(hogs[i], NULL, 0);
+	}
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+	return ret;
+}
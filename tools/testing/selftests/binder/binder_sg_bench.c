@@ -0,0 +1,293 @@
+/*
+ * binder_sg_bench: compare BC_TRANSACTION with BC_TRANSACTION_SG.
+ *
+ * The client builds each payload from four separate fragments, the way
+ * a parcel with a header and a few large blobs looks in practice.  In
+ * "flat" mode the fragments are first copied into one contiguous buffer
+ * and sent with BC_TRANSACTION, in "sg" mode they are handed to the
+ * driver as an iovec with BC_TRANSACTION_SG and gathered straight into
+ * the target buffer.  The server checks a marker at both ends of every
+ * payload and the client reports throughput for each payload size.
+ *
+ * Usage: binder_sg_bench [-n iterations] [-m max_size]
+ */
+
+#define BINDER_MAP_SIZE		(4 * 1024 * 1024)
+
+#include <getopt.h>
+#include <signal.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "binder_test.h"
+
+#define NR_FRAGS	4
+#define MIN_SIZE	(4 * 1024)
+
+static int nr_iters = 200;
+static size_t max_size = 1024 * 1024;
+
+static struct binder_ctx ctx;
+
+static void cmdbuf_txn_sg(struct binder_cmdbuf *cb, uint32_t code,
+			  const struct iovec *iov, size_t iovcnt,
+			  size_t data_size)
+{
+	struct binder_transaction_data_sg tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.transaction_data.code = code;
+	tr.transaction_data.data_size = data_size;
+	tr.data_iov = iov;
+	tr.data_iovcnt = iovcnt;
+	cmdbuf_cmd(cb, BC_TRANSACTION_SG);
+	cmdbuf_put(cb, &tr, sizeof(tr));
+}
+
+/* ---- server ---- */
+
+static void run_server(void)
+{
+	uint32_t rbuf[64];
+	uint32_t reply;
+	struct binder_cmdbuf cb;
+
+	cmdbuf_reset(&cb);
+	cmdbuf_cmd(&cb, BC_ENTER_LOOPER);
+	for (;;) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+
+		if (binder_write_read(ctx.fd, cb.data, cb.len, rbuf, &rlen))
+			exit(1);
+		cmdbuf_reset(&cb);
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			if (cmd == BR_TRANSACTION) {
+				struct binder_transaction_data *tr = (void *)ptr;
+				const uint32_t *data = tr->data.ptr.buffer;
+				size_t words = tr->data_size / sizeof(*data);
+
+				reply = words ? data[0] + data[words - 1] : 0;
+				cmdbuf_free_buffer(&cb, tr->data.ptr.buffer);
+				cmdbuf_txn(&cb, BC_REPLY, 0, 0, 0,
+					   &reply, sizeof(reply), NULL, 0);
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+}
+
+/* ---- client ---- */
+
+/*
+ * Runs one transaction and waits for the reply.  Returns 1 on success,
+ * 0 on failure and -1 if the driver rejected the command outright.
+ */
+static int client_call(struct binder_cmdbuf *cb, uint32_t expect)
+{
+	uint32_t rbuf[64];
+	int got_reply = 0, ok = 1;
+	int ret;
+
+	while (!got_reply) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+
+		ret = binder_write_read(ctx.fd, cb->data, cb->len, rbuf, &rlen);
+		cmdbuf_reset(cb);
+		if (ret == -EINVAL)
+			return -1;
+		if (ret)
+			return 0;
+
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_REPLY: {
+				struct binder_transaction_data *tr = (void *)ptr;
+
+				got_reply = 1;
+				if (tr->data_size != sizeof(uint32_t) ||
+				    *(const uint32_t *)tr->data.ptr.buffer != expect)
+					ok = 0;
+				cmdbuf_free_buffer(cb, tr->data.ptr.buffer);
+				break;
+			}
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+			case BR_ERROR:
+				return 0;
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	if (cb->len && binder_write(ctx.fd, cb->data, cb->len))
+		ok = 0;
+	cmdbuf_reset(cb);
+	return ok;
+}
+
+/* Returns MB/s, 0 on failure and -1 if BC_TRANSACTION_SG is unknown. */
+static double bench(size_t size, int sg, uint8_t **frags, uint8_t *flat)
+{
+	struct iovec iov[NR_FRAGS];
+	struct binder_cmdbuf cb;
+	size_t frag = size / NR_FRAGS;
+	uint64_t start, elapsed;
+	int i, j, ret;
+
+	for (j = 0; j < NR_FRAGS; j++) {
+		iov[j].iov_base = frags[j];
+		iov[j].iov_len = frag;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_iters; i++) {
+		uint32_t head = i, tail = i * 2654435761u;
+
+		memcpy(frags[0], &head, sizeof(head));
+		memcpy(frags[NR_FRAGS - 1] + frag - sizeof(tail), &tail,
+		       sizeof(tail));
+
+		cmdbuf_reset(&cb);
+		if (sg) {
+			cmdbuf_txn_sg(&cb, 1, iov, NR_FRAGS, size);
+		} else {
+			for (j = 0; j < NR_FRAGS; j++)
+				memcpy(flat + j * frag, frags[j], frag);
+			cmdbuf_txn(&cb, BC_TRANSACTION, 0, 1, 0,
+				   flat, size, NULL, 0);
+		}
+		ret = client_call(&cb, head + tail);
+		if (ret <= 0)
+			return ret;
+	}
+	elapsed = now_ns() - start;
+	return (double)size * nr_iters / (elapsed ? elapsed : 1) * 1e9 /
+		(1024 * 1024);
+}
+
+static int run_client(void)
+{
+	uint8_t *frags[NR_FRAGS], *flat;
+	size_t size;
+	int j;
+
+	for (j = 0; j < NR_FRAGS; j++) {
+		frags[j] = malloc(max_size / NR_FRAGS);
+		if (!frags[j])
+			return 1;
+		memset(frags[j], j + 1, max_size / NR_FRAGS);
+	}
+	flat = malloc(max_size);
+	if (!flat)
+		return 1;
+
+	printf("%10s %12s %12s\n", "size", "flat MB/s", "sg MB/s");
+	for (size = MIN_SIZE; size <= max_size; size *= 4) {
+		double flat_mbs, sg_mbs;
+
+		flat_mbs = bench(size, 0, frags, flat);
+		sg_mbs = bench(size, 1, frags, flat);
+		if (sg_mbs < 0) {
+			printf("binder_sg_bench: BC_TRANSACTION_SG not "
+			       "supported, skipping\n");
+			return 0;
+		}
+		if (flat_mbs <= 0 || sg_mbs <= 0) {
+			printf("binder_sg_bench: FAIL at size %zu\n", size);
+			return 1;
+		}
+		printf("%10zu %12.1f %12.1f\n", size, flat_mbs, sg_mbs);
+	}
+	printf("binder_sg_bench: PASS\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	pid_t server;
+	int opt, pipefd[2], ret;
+	char c;
+
+	while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_iters = atoi(optarg);
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] "
+				"[-m max_size]\n", argv[0]);
+			return 1;
+		}
+	}
+	/* leave room in the server's buffer for the binder_buffer header */
+	if (max_size > BINDER_MAP_SIZE / 2)
+		max_size = BINDER_MAP_SIZE / 2;
+	if (max_size < MIN_SIZE)
+		max_size = MIN_SIZE;
+
+	if (access(BINDER_DEV, R_OK | W_OK)) {
+		printf("binder_sg_bench: %s not available, skipping\n",
+		       BINDER_DEV);
+		return 0;
+	}
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 1;
+	}
+	server = fork();
+	if (server == 0) {
+		close(pipefd[0]);
+		if (binder_ctx_open(&ctx))
+			c = 'E';
+		else if (ioctl(ctx.fd, BINDER_SET_CONTEXT_MGR, 0))
+			c = errno == EBUSY || errno == EPERM ? 'B' : 'E';
+		else
+			c = 'R';
+		if (write(pipefd[1], &c, 1) != 1 || c != 'R')
+			_exit(1);
+		close(pipefd[1]);
+		run_server();
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1 || c != 'R') {
+		waitpid(server, NULL, 0);
+		if (c == 'B') {
+			printf("binder_sg_bench: context manager already "
+			       "registered, skipping\n");
+			return 0;
+		}
+		fprintf(stderr, "binder_sg_bench: server setup failed\n");
+		return 1;
+	}
+	close(pipefd[0]);
+
+	ret = binder_ctx_open(&ctx);
+	if (ret) {
+		fprintf(stderr, "binder_sg_bench: open: %s\n", strerror(-ret));
+		ret = 1;
+	} else {
+		ret = run_client();
+		binder_ctx_close(&ctx);
+	}
+
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+	return ret;
+}
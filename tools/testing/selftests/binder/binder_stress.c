@@ -0,0 +1,477 @@
+/*
+ * binder_stress: multi-process binder transaction stress test.
+ *
+ * One process becomes the context manager and serves transactions on
+ * handle 0 from a pool of looper threads.  A number of client processes,
+ * each with several threads, hammer it with synchronous calls and
+ * one-way calls.  Some of the calls carry a binder object so that nodes,
+ * refs and the BR_INCREFS/BR_ACQUIRE handshake are exercised as well,
+ * and a fraction of the clients are killed mid-run so that process
+ * teardown races with in-flight transactions.
+ *
+ * The test reports aggregate throughput and per-call latency and fails
+ * if any surviving client sees an unexpected error or a corrupt reply.
+ *
+ * Usage: binder_stress [-p procs] [-t threads] [-n iterations]
+ *			[-s server_threads] [-k kill_every]
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/wait.h>
+
+#include "binder_test.h"
+
+#define CODE_PING	1
+#define CODE_ONEWAY	2
+
+struct stress_payload {
+	uint32_t seq;
+	uint32_t pid;
+	struct flat_binder_object obj;
+};
+
+struct stress_stats {
+	uint64_t calls;
+	uint64_t oneways;
+	uint64_t lat_total_ns;
+	uint64_t lat_max_ns;
+	uint64_t failures;
+};
+
+static int nr_procs = 4;
+static int nr_threads = 4;
+static int nr_iters = 2000;
+static int nr_server_threads = 8;
+static int kill_every = 4;
+
+static struct stress_stats *shared_stats;
+
+static void stats_add(const struct stress_stats *s)
+{
+	uint64_t old;
+
+	__sync_fetch_and_add(&shared_stats->calls, s->calls);
+	__sync_fetch_and_add(&shared_stats->oneways, s->oneways);
+	__sync_fetch_and_add(&shared_stats->lat_total_ns, s->lat_total_ns);
+	__sync_fetch_and_add(&shared_stats->failures, s->failures);
+	do {
+		old = shared_stats->lat_max_ns;
+		if (s->lat_max_ns <= old)
+			break;
+	} while (!__sync_bool_compare_and_swap(&shared_stats->lat_max_ns,
+					       old, s->lat_max_ns));
+}
+
+/* ---- server ---- */
+
+static struct binder_ctx server_ctx;
+
+static void *server_thread(void *arg)
+{
+	uint32_t rbuf[256];
+	uint32_t reply_seq;
+	struct binder_cmdbuf cb;
+	int fd = server_ctx.fd;
+
+	(void)arg;
+	cmdbuf_reset(&cb);
+	cmdbuf_cmd(&cb, BC_ENTER_LOOPER);
+
+	for (;;) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+		int ret;
+
+		ret = binder_write_read(fd, cb.data, cb.len, rbuf, &rlen);
+		cmdbuf_reset(&cb);
+		if (ret) {
+			fprintf(stderr, "server: BINDER_WRITE_READ: %s\n",
+				strerror(-ret));
+			exit(1);
+		}
+
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_TRANSACTION: {
+				struct binder_transaction_data *tr = (void *)ptr;
+
+				reply_seq = 0;
+				if (tr->data_size >= sizeof(uint32_t))
+					reply_seq = *(const uint32_t *)tr->data.ptr.buffer + 1;
+				cmdbuf_free_buffer(&cb, tr->data.ptr.buffer);
+				if (!(tr->flags & TF_ONE_WAY))
+					cmdbuf_txn(&cb, BC_REPLY, 0, 0, 0,
+						   &reply_seq, sizeof(reply_seq),
+						   NULL, 0);
+				break;
+			}
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				cmdbuf_ack_ref(&cb, cmd, (void *)ptr);
+				break;
+			case BR_DEAD_BINDER:
+				cmdbuf_cmd(&cb, BC_DEAD_BINDER_DONE);
+				cmdbuf_ptr(&cb, *(void **)ptr);
+				break;
+			default:
+				/*
+				 * BR_DEAD_REPLY/BR_FAILED_REPLY are expected
+				 * when the client we are replying to was
+				 * killed.
+				 */
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	return NULL;
+}
+
+static void run_server(void)
+{
+	pthread_t *tids;
+	int i;
+
+	tids = calloc(nr_server_threads, sizeof(*tids));
+	for (i = 1; i < nr_server_threads; i++)
+		pthread_create(&tids[i], NULL, server_thread, NULL);
+	server_thread(NULL);
+}
+
+/* ---- client ---- */
+
+struct client_thread {
+	int fd;
+	int idx;
+	int iters;
+	uint32_t node_token;
+	struct stress_stats stats;
+};
+
+static int client_call(struct client_thread *ct, uint32_t seq, int oneway,
+		       int with_object)
+{
+	struct stress_payload payload;
+	size_t offsets[1] = { offsetof(struct stress_payload, obj) };
+	struct binder_cmdbuf cb;
+	uint32_t rbuf[128];
+	int got_reply = 0, got_complete = 0;
+	int ok = 1;
+
+	memset(&payload, 0, sizeof(payload));
+	payload.seq = seq;
+	payload.pid = getpid();
+	if (with_object) {
+		payload.obj.type = BINDER_TYPE_BINDER;
+		payload.obj.binder = &ct->node_token;
+		payload.obj.cookie = &ct->node_token;
+	}
+
+	cmdbuf_reset(&cb);
+	cmdbuf_txn(&cb, BC_TRANSACTION, 0,
+		   oneway ? CODE_ONEWAY : CODE_PING,
+		   oneway ? TF_ONE_WAY : 0,
+		   &payload, sizeof(payload),
+		   offsets, with_object ? sizeof(offsets) : 0);
+
+	while (!got_complete || (!oneway && !got_reply)) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+		int ret;
+
+		ret = binder_write_read(ct->fd, cb.data, cb.len, rbuf, &rlen);
+		cmdbuf_reset(&cb);
+		if (ret) {
+			fprintf(stderr, "client %d: BINDER_WRITE_READ: %s\n",
+				getpid(), strerror(-ret));
+			return 0;
+		}
+
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_SPAWN_LOOPER:
+			case BR_RELEASE:
+			case BR_DECREFS:
+				break;
+			case BR_TRANSACTION_COMPLETE:
+				got_complete = 1;
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				cmdbuf_ack_ref(&cb, cmd, (void *)ptr);
+				break;
+			case BR_REPLY: {
+				struct binder_transaction_data *tr = (void *)ptr;
+
+				got_reply = 1;
+				if (tr->data_size != sizeof(uint32_t) ||
+				    *(const uint32_t *)tr->data.ptr.buffer != seq + 1) {
+					fprintf(stderr, "client %d: bad reply\n",
+						getpid());
+					ok = 0;
+				}
+				cmdbuf_free_buffer(&cb, tr->data.ptr.buffer);
+				break;
+			}
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+			case BR_ERROR:
+				fprintf(stderr, "client %d: call failed (%08x)\n",
+					getpid(), cmd);
+				return 0;
+			default:
+				break;
+			}
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	/* flush the trailing BC_FREE_BUFFER / *_DONE acknowledgements */
+	if (cb.len && binder_write(ct->fd, cb.data, cb.len))
+		ok = 0;
+	return ok;
+}
+
+static void *client_thread(void *arg)
+{
+	struct client_thread *ct = arg;
+	int i;
+
+	for (i = 0; i < ct->iters; i++) {
+		int oneway = (i % 8) == 7;
+		int with_object = (i % 4) == ct->idx % 4;
+		uint64_t start = now_ns(), lat;
+
+		if (!client_call(ct, i, oneway, with_object)) {
+			ct->stats.failures++;
+			continue;
+		}
+		lat = now_ns() - start;
+		if (oneway) {
+			ct->stats.oneways++;
+			continue;
+		}
+		ct->stats.calls++;
+		ct->stats.lat_total_ns += lat;
+		if (lat > ct->stats.lat_max_ns)
+			ct->stats.lat_max_ns = lat;
+	}
+	ioctl(ct->fd, BINDER_THREAD_EXIT, 0);
+	return NULL;
+}
+
+/*
+ * Drains process-wide work (BR_RELEASE/BR_DECREFS for nodes handed to
+ * the server) so that node teardown runs concurrently with the calls.
+ */
+static void *client_looper(void *arg)
+{
+	int fd = *(int *)arg;
+	struct binder_cmdbuf cb;
+	uint32_t rbuf[64];
+
+	cmdbuf_reset(&cb);
+	cmdbuf_cmd(&cb, BC_ENTER_LOOPER);
+	for (;;) {
+		size_t rlen = sizeof(rbuf);
+		uint8_t *ptr, *end;
+
+		if (binder_write_read(fd, cb.data, cb.len, rbuf, &rlen))
+			break;
+		cmdbuf_reset(&cb);
+		ptr = (uint8_t *)rbuf;
+		end = ptr + rlen;
+		while (ptr < end) {
+			uint32_t cmd = *(uint32_t *)ptr;
+
+			ptr += sizeof(cmd);
+			if (cmd == BR_INCREFS || cmd == BR_ACQUIRE)
+				cmdbuf_ack_ref(&cb, cmd, (void *)ptr);
+			ptr += _IOC_SIZE(cmd);
+		}
+	}
+	return NULL;
+}
+
+static void run_client(int idx)
+{
+	struct binder_ctx ctx;
+	struct client_thread *cts;
+	struct stress_stats total;
+	pthread_t looper, *tids;
+	int doomed = kill_every && (idx % kill_every) == kill_every - 1;
+	int i, ret;
+
+	ret = binder_ctx_open(&ctx);
+	if (ret) {
+		fprintf(stderr, "client %d: open: %s\n", idx, strerror(-ret));
+		exit(1);
+	}
+	pthread_create(&looper, NULL, client_looper, &ctx.fd);
+
+	cts = calloc(nr_threads, sizeof(*cts));
+	tids = calloc(nr_threads, sizeof(*tids));
+	for (i = 0; i < nr_threads; i++) {
+		cts[i].fd = ctx.fd;
+		cts[i].idx = i;
+		cts[i].iters = doomed ? nr_iters / 2 : nr_iters;
+		pthread_create(&tids[i], NULL, client_thread, &cts[i]);
+	}
+
+	if (doomed) {
+		/* die with transactions still in flight */
+		usleep(1000 * (10 + idx));
+		kill(getpid(), SIGKILL);
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(tids[i], NULL);
+		total.calls += cts[i].stats.calls;
+		total.oneways += cts[i].stats.oneways;
+		total.lat_total_ns += cts[i].stats.lat_total_ns;
+		total.failures += cts[i].stats.failures;
+		if (cts[i].stats.lat_max_ns > total.lat_max_ns)
+			total.lat_max_ns = cts[i].stats.lat_max_ns;
+	}
+	stats_add(&total);
+	_exit(total.failures ? 1 : 0);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t server, *clients;
+	uint64_t start, elapsed;
+	int i, opt, status, failed = 0, killed = 0;
+	int pipefd[2];
+	char c;
+
+	while ((opt = getopt(argc, argv, "p:t:n:s:k:")) != -1) {
+		switch (opt) {
+		case 'p':
+			nr_procs = atoi(optarg);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_iters = atoi(optarg);
+			break;
+		case 's':
+			nr_server_threads = atoi(optarg);
+			break;
+		case 'k':
+			kill_every = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p procs] [-t threads] "
+				"[-n iterations] [-s server_threads] "
+				"[-k kill_every]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_server_threads < 1)
+		nr_server_threads = 1;
+
+	if (access(BINDER_DEV, R_OK | W_OK)) {
+		printf("binder_stress: %s not available, skipping\n",
+		       BINDER_DEV);
+		return 0;
+	}
+
+	shared_stats = mmap(NULL, sizeof(*shared_stats),
+			    PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared_stats == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	memset(shared_stats, 0, sizeof(*shared_stats));
+
+	if (pipe(pipefd)) {
+		perror("pipe");
+		return 1;
+	}
+	server = fork();
+	if (server == 0) {
+		close(pipefd[0]);
+		if (binder_ctx_open(&server_ctx)) {
+			c = 'E';
+		} else if (ioctl(server_ctx.fd, BINDER_SET_CONTEXT_MGR, 0)) {
+			c = errno == EBUSY || errno == EPERM ? 'B' : 'E';
+		} else {
+			c = 'R';
+		}
+		if (write(pipefd[1], &c, 1) != 1 || c != 'R')
+			_exit(1);
+		close(pipefd[1]);
+		run_server();
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1 || c != 'R') {
+		waitpid(server, NULL, 0);
+		if (c == 'B') {
+			printf("binder_stress: context manager already "
+			       "registered, skipping\n");
+			return 0;
+		}
+		fprintf(stderr, "binder_stress: server setup failed\n");
+		return 1;
+	}
+	close(pipefd[0]);
+
+	clients = calloc(nr_procs, sizeof(*clients));
+	start = now_ns();
+	for (i = 0; i < nr_procs; i++) {
+		clients[i] = fork();
+		if (clients[i] == 0)
+			run_client(i);
+	}
+	for (i = 0; i < nr_procs; i++) {
+		waitpid(clients[i], &status, 0);
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+			killed++;
+		else if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed++;
+	}
+	elapsed = now_ns() - start;
+
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+
+	printf("binder_stress: %d procs x %d threads, %d killed\n",
+	       nr_procs, nr_threads, killed);
+	printf("  calls %llu oneway %llu in %llu ms (%llu txn/s)\n",
+	       (unsigned long long)shared_stats->calls,
+	       (unsigned long long)shared_stats->oneways,
+	       (unsigned long long)(elapsed / 1000000),
+	       (unsigned long long)((shared_stats->calls +
+				     shared_stats->oneways) * 1000000000ULL /
+				    (elapsed ? elapsed : 1)));
+	if (shared_stats->calls)
+		printf("  latency avg %llu us max %llu us\n",
+		       (unsigned long long)(shared_stats->lat_total_ns /
+					    shared_stats->calls / 1000),
+		       (unsigned long long)(shared_stats->lat_max_ns / 1000));
+
+	if (failed || shared_stats->failures) {
+		printf("binder_stress: FAIL (%d clients, %llu calls failed)\n",
+		       failed, (unsigned long long)shared_stats->failures);
+		return 1;
+	}
+	printf("binder_stress: PASS\n");
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Minimal helpers shared by the binder selftests.  They talk to
+ * /dev/binder directly through BINDER_WRITE_READ so the tests do not
+ * depend on libbinder.
+ */
+#ifndef _BINDER_TEST_H
+#define _BINDER_TEST_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#ifndef BINDER_MAP_SIZE
+#define BINDER_MAP_SIZE		(1024 * 1024)
+#endif
+
+struct binder_ctx {
+	int fd;
+	void *map;
+};
+
+static inline int binder_ctx_open(struct binder_ctx *ctx)
+{
+	struct binder_version vers;
+
+	ctx->fd = open(BINDER_DEV, O_RDWR);
+	if (ctx->fd < 0)
+		return -errno;
+	if (ioctl(ctx->fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		close(ctx->fd);
+		return -EPROTO;
+	}
+	ctx->map = mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE,
+			ctx->fd, 0);
+	if (ctx->map == MAP_FAILED) {
+		close(ctx->fd);
+		return -errno;
+	}
+	return 0;
+}
+
+static inline void binder_ctx_close(struct binder_ctx *ctx)
+{
+	munmap(ctx->map, BINDER_MAP_SIZE);
+	close(ctx->fd);
+}
+
+/*
+ * Issue one BINDER_WRITE_READ.  On return *rlen holds the number of
+ * bytes the driver wrote into rbuf.  EINTR is retried.
+ */
+static inline int binder_write_read(int fd, const void *wbuf, size_t wlen,
+				    void *rbuf, size_t *rlen)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = wlen;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rlen ? *rlen : 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+		if (ret < 0 && errno == EINTR && (size_t)bwr.write_consumed == wlen)
+			bwr.write_size = 0;
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+	if (rlen)
+		*rlen = bwr.read_consumed;
+	return 0;
+}
+
+static inline int binder_write(int fd, const void *wbuf, size_t wlen)
+{
+	return binder_write_read(fd, wbuf, wlen, NULL, NULL);
+}
+
+/* Simple command buffer used to batch BC_* commands. */
+struct binder_cmdbuf {
+	size_t len;
+	uint8_t data[512];
+};
+
+static inline void cmdbuf_reset(struct binder_cmdbuf *cb)
+{
+	cb->len = 0;
+}
+
+static inline void cmdbuf_put(struct binder_cmdbuf *cb, const void *p,
+			      size_t len)
+{
+	if (cb->len + len > sizeof(cb->data)) {
+		fprintf(stderr, "binder_test: command buffer overflow\n");
+		exit(1);
+	}
+	memcpy(cb->data + cb->len, p, len);
+	cb->len += len;
+}
+
+static inline void cmdbuf_cmd(struct binder_cmdbuf *cb, uint32_t cmd)
+{
+	cmdbuf_put(cb, &cmd, sizeof(cmd));
+}
+
+static inline void cmdbuf_ptr(struct binder_cmdbuf *cb, const void *ptr)
+{
+	cmdbuf_put(cb, &ptr, sizeof(ptr));
+}
+
+static inline void cmdbuf_free_buffer(struct binder_cmdbuf *cb,
+				      const void *buffer)
+{
+	cmdbuf_cmd(cb, BC_FREE_BUFFER);
+	cmdbuf_ptr(cb, buffer);
+}
+
+static inline void cmdbuf_txn(struct binder_cmdbuf *cb, uint32_t cmd,
+			      uint32_t handle, uint32_t code, uint32_t flags,
+			      const void *data, size_t data_size,
+			      const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = flags;
+	tr.data_size = data_size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	cmdbuf_cmd(cb, cmd);
+	cmdbuf_put(cb, &tr, sizeof(tr));
+}
+
+/*
+ * Queue the acknowledgement the driver expects for BR_INCREFS/BR_ACQUIRE.
+ * Other BR_* commands need no answer from these tests.
+ */
+static inline void cmdbuf_ack_ref(struct binder_cmdbuf *cb, uint32_t cmd,
+				  const struct binder_ptr_cookie *pc)
+{
+	if (cmd == BR_INCREFS)
+		cmdbuf_cmd(cb, BC_INCREFS_DONE);
+	else if (cmd == BR_ACQUIRE)
+		cmdbuf_cmd(cb, BC_ACQUIRE_DONE);
+	else
+		return;
+	cmdbuf_put(cb, pc, sizeof(*pc));
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * ion_bench: allocation latency of the ION system heap.
+ *
+ * For a set of buffer sizes typical of gralloc (a small texture, one
+ * WVGA, 720p and 1080p RGBA frame), every iteration allocates a cached
+ * buffer from the system heap, shares and mmaps it, checks that it reads
+ * back as zeroes, scribbles over it and frees it again.  The first
+ * iteration of each size usually has to go to the page allocator, the
+ * following ones should be served from the heap's page pools; both are
+ * reported separately.
+ *
+ * A buffer that is not zeroed when handed out would leak the previous
+ * user's data, so any non-zero byte fails the test.
+ *
+ * Usage: ion_bench [-d device] [-i heap_id] [-n iterations]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+/* From include/linux/ion.h, which needs the kernel's mach headers. */
+struct ion_handle;
+
+struct ion_allocation_data {
+	size_t len;
+	size_t align;
+	unsigned int flags;
+	struct ion_handle *handle;
+};
+
+struct ion_fd_data {
+	struct ion_handle *handle;
+	int fd;
+};
+
+struct ion_handle_data {
+	struct ion_handle *handle;
+};
+
+#define ION_IOC_MAGIC		'I'
+#define ION_IOC_ALLOC		_IOWR(ION_IOC_MAGIC, 0, \
+				      struct ion_allocation_data)
+#define ION_IOC_FREE		_IOWR(ION_IOC_MAGIC, 1, struct ion_handle_data)
+#define ION_IOC_SHARE		_IOWR(ION_IOC_MAGIC, 4, struct ion_fd_data)
+
+#define ION_HEAP(bit)		(1 << (bit))
+#define ION_SYSTEM_HEAP_ID	30
+#define ION_CACHED		1
+
+static const char *device = "/dev/ion";
+static int heap_id = ION_SYSTEM_HEAP_ID;
+static int iterations = 50;
+
+static const struct {
+	const char *name;
+	size_t size;
+} sizes[] = {
+	{ "256x256",	256 * 256 * 4 },
+	{ "480x800",	480 * 800 * 4 },
+	{ "720x1280",	720 * 1280 * 4 },
+	{ "1080x1920",	1080 * 1920 * 4 },
+};
+
+struct stats {
+	uint64_t cold_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t total_ns;
+	int nr;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void account(struct stats *st, uint64_t ns)
+{
+	if (!st->nr++) {
+		st->cold_ns = ns;
+		return;
+	}
+	if (!st->min_ns || ns < st->min_ns)
+		st->min_ns = ns;
+	if (ns > st->max_ns)
+		st->max_ns = ns;
+	st->total_ns += ns;
+}
+
+/* Returns 0, 1 if the buffer was not zeroed, or -1 on error. */
+static int one_buffer(int fd, size_t len, struct stats *alloc,
+		      struct stats *freeing)
+{
+	struct ion_allocation_data data = {
+		.len = len,
+		.align = 4096,
+		.flags = ION_HEAP(heap_id) | ION_CACHED,
+	};
+	struct ion_handle_data hd;
+	struct ion_fd_data fdd;
+	uint64_t start;
+	unsigned char *p;
+	size_t i;
+	int ret = 0;
+
+	start = now_ns();
+	if (ioctl(fd, ION_IOC_ALLOC, &data))
+		return -1;
+	account(alloc, now_ns() - start);
+
+	fdd.handle = data.handle;
+	if (ioctl(fd, ION_IOC_SHARE, &fdd)) {
+		ret = -1;
+		goto out;
+	}
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fdd.fd, 0);
+	if (p == MAP_FAILED) {
+		ret = -1;
+		goto out_close;
+	}
+	for (i = 0; i < len; i++) {
+		if (p[i]) {
+			ret = 1;
+			break;
+		}
+	}
+	memset(p, 0xa5, len);
+	munmap(p, len);
+out_close:
+	close(fdd.fd);
+out:
+	hd.handle = data.handle;
+	start = now_ns();
+	if (ioctl(fd, ION_IOC_FREE, &hd))
+		return -1;
+	account(freeing, now_ns() - start);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int fd, opt, i, n;
+	int dirty = 0;
+
+	while ((opt = getopt(argc, argv, "d:i:n:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'i':
+			heap_id = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-i heap_id] "
+				"[-n iterations]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (iterations < 2)
+		iterations = 2;
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0) {
+		printf("ion_bench: %s not available (%s), skipping\n",
+		       device, strerror(errno));
+		return 0;
+	}
+
+	printf("ion_bench: heap %d, %d iterations per size\n", heap_id,
+	       iterations);
+	printf("buffer          size   cold us  alloc us (min/avg/max)"
+	       "      free us (avg)\n");
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+		struct stats alloc = { 0 }, freeing = { 0 };
+
+		for (n = 0; n < iterations; n++) {
+			int ret = one_buffer(fd, sizes[i].size, &alloc,
+					     &freeing);
+
+			if (ret < 0) {
+				printf("ion_bench: %s buffer failed: %s\n",
+				       sizes[i].name, strerror(errno));
+				close(fd);
+				return 1;
+			}
+			dirty += ret;
+		}
+		printf("%-10s %7zuK %9.1f %9.1f/%.1f/%.1f %12.1f\n",
+		       sizes[i].name, sizes[i].size >> 10,
+		       alloc.cold_ns / 1e3, alloc.min_ns / 1e3,
+		       alloc.total_ns / 1e3 / (alloc.nr - 1),
+		       alloc.max_ns / 1e3,
+		       (freeing.total_ns + freeing.cold_ns) / 1e3 / freeing.nr);
+	}
+	close(fd);
+
+	if (dirty) {
+		printf("ion_bench: %d buffers were not zeroed\n", dirty);
+		printf("ion_bench: FAIL\n");
+		return 1;
+	}
+	printf("ion_bench: PASS\n");
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * read_latency: read latency of a block device under concurrent writeback.
+ *
+ * A writer process keeps dirtying a file of -w MB with buffered writes,
+ * so that the flusher threads keep the device busy with writeback, while
+ * a reader does random 4 KB O_DIRECT reads of another file and records
+ * the latency of each.  Both files live in -d dir, which should be on
+ * the device under test.  The latency distribution of the reads is
+ * reported for every I/O scheduler given with -e (comma separated), or
+ * for the one currently in use if -e is not given.  Switching schedulers
+ * needs root; the original one is restored at the end.
+ *
+ * Usage: read_latency [-d dir] [-s seconds] [-w write_mbytes]
+ *			[-e sched[,sched...]]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define BLOCK		4096
+#define CHUNK		(1 << 20)
+#define READ_FILE_MB	64
+#define MAX_SAMPLES	(1 << 20)
+
+static const char *dir = ".";
+static int seconds = 10;
+static size_t write_bytes = 256 << 20;
+static char *scheds;
+
+static char sched_path[PATH_MAX + 32];
+static char read_file[PATH_MAX], write_file[PATH_MAX];
+static uint32_t samples[MAX_SAMPLES];
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Finds the queue/scheduler file of the disk dir lives on. */
+static int find_queue(void)
+{
+	char link[64], path[PATH_MAX];
+	struct stat st;
+
+	if (stat(dir, &st))
+		return -1;
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	if (!realpath(link, path))
+		return -1;
+
+	snprintf(sched_path, sizeof(sched_path), "%s/queue/scheduler", path);
+	if (!access(sched_path, F_OK))
+		return 0;
+	/* A partition: the queue belongs to the parent disk. */
+	snprintf(sched_path, sizeof(sched_path), "%s/../queue/scheduler",
+		 path);
+	return access(sched_path, F_OK);
+}
+
+/* Reads the current scheduler, the one shown in [brackets]. */
+static int get_sched(char *buf, size_t len)
+{
+	char line[256], *start, *end;
+	FILE *f = fopen(sched_path, "r");
+
+	if (!f)
+		return -1;
+	if (!fgets(line, sizeof(line), f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	start = strchr(line, '[');
+	end = start ? strchr(start, ']') : NULL;
+	if (!end)
+		return -1;
+	*end = '\0';
+	snprintf(buf, len, "%s", start + 1);
+	return 0;
+}
+
+static int set_sched(const char *name)
+{
+	FILE *f = fopen(sched_path, "w");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%s\n", name) < 0;
+	return (fclose(f) || ret) ? -1 : 0;
+}
+
+static int create_file(const char *path, size_t len)
+{
+	char *buf = malloc(CHUNK);
+	size_t done;
+	int fd;
+
+	if (!buf)
+		return -1;
+	memset(buf, 0x5a, CHUNK);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		free(buf);
+		return -1;
+	}
+	for (done = 0; done < len; done += CHUNK) {
+		if (write(fd, buf, CHUNK) != CHUNK) {
+			free(buf);
+			close(fd);
+			return -1;
+		}
+	}
+	free(buf);
+	fsync(fd);
+	close(fd);
+	return 0;
+}
+
+static void writer(void)
+{
+	char *buf = malloc(CHUNK);
+	size_t off = 0;
+	int fd;
+
+	fd = open(write_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || !buf)
+		_exit(1);
+	memset(buf, 0xa5, CHUNK);
+	for (;;) {
+		if (pwrite(fd, buf, CHUNK, off) != CHUNK)
+			_exit(1);
+		off += CHUNK;
+		if (off >= write_bytes)
+			off = 0;
+	}
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Returns the number of samples taken, or -1 on error. */
+static long reader(void)
+{
+	size_t blocks = ((size_t)READ_FILE_MB << 20) / BLOCK;
+	uint64_t end = now_ns() + (uint64_t)seconds * 1000000000ULL;
+	uint32_t x = 2654435761u;
+	long nr = 0;
+	void *buf;
+	int fd;
+
+	if (posix_memalign(&buf, BLOCK, BLOCK))
+		return -1;
+	fd = open(read_file, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		free(buf);
+		return -1;
+	}
+	while (now_ns() < end && nr < MAX_SAMPLES) {
+		uint64_t start;
+
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		start = now_ns();
+		if (pread(fd, buf, BLOCK, (off_t)(x % blocks) * BLOCK) != BLOCK) {
+			nr = -1;
+			break;
+		}
+		samples[nr++] = (now_ns() - start) / 1000;
+	}
+	close(fd);
+	free(buf);
+	return nr;
+}
+
+static int run(const char *name)
+{
+	pid_t pid;
+	long nr;
+
+	if (name && set_sched(name)) {
+		printf("read_latency: cannot select %s: %s\n", name,
+		       strerror(errno));
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (!pid)
+		writer();
+	/* Let dirty pages build up so that writeback is going on. */
+	sleep(2);
+
+	nr = reader();
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	if (nr <= 0)
+		return -1;
+
+	qsort(samples, nr, sizeof(samples[0]), cmp_u32);
+	printf("%-10s %8.0f %8u %8u %8u %8u %9u\n", name ? name : "current",
+	       (double)nr / seconds, samples[nr / 2], samples[nr * 9 / 10],
+	       samples[nr * 99 / 100], samples[nr * 999 / 1000],
+	       samples[nr - 1]);
+
+	/* Do not leave the next run with this one's writeback. */
+	sync();
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char orig[64] = "";
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "d:s:w:e:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'w':
+			write_bytes = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'e':
+			scheds = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-s seconds] "
+				"[-w write_mbytes] [-e sched[,sched...]]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (seconds < 1)
+		seconds = 1;
+	if (write_bytes < CHUNK)
+		write_bytes = CHUNK;
+
+	if (find_queue() || get_sched(orig, sizeof(orig))) {
+		printf("read_latency: %s is not on a block device with an "
+		       "I/O scheduler, skipping\n", dir);
+		return 0;
+	}
+
+	snprintf(read_file, sizeof(read_file), "%s/read_latency_rd.dat", dir);
+	snprintf(write_file, sizeof(write_file), "%s/read_latency_wr.dat",
+		 dir);
+	if (create_file(read_file, (size_t)READ_FILE_MB << 20)) {
+		printf("read_latency: cannot create %s: %s\n", read_file,
+		       strerror(errno));
+		return 1;
+	}
+
+	printf("read_latency: %s, 4K random O_DIRECT reads, %zu MB "
+	       "buffered writer, %d s per run\n", sched_path,
+	       write_bytes >> 20, seconds);
+	printf("scheduler   reads/s   p50 us   p90 us   p99 us p99.9 us"
+	       "    max us\n");
+	if (scheds) {
+		char *name = strtok(scheds, ",");
+
+		for (; name; name = strtok(NULL, ","))
+			if (run(name))
+				ret = 1;
+		set_sched(orig);
+	} else if (run(NULL)) {
+		ret = 1;
+	}
+
+	unlink(read_file);
+	unlink(write_file);
+	if (ret) {
+		printf("read_latency: FAIL\n");
+		return 1;
+	}
+	printf("read_latency: PASS\n");
+	return 0;
+}
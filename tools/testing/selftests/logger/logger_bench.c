@@ -0,0 +1,237 @@
+/*
+ * logger_bench: multi-writer/multi-reader throughput for the Android logs.
+ *
+ * A number of writer threads log numbered messages the way liblog does
+ * (priority byte, tag, message) while reader threads drain the same
+ * log.  Each reader checks that the messages it sees from every writer
+ * are intact and in order; messages may be missing if the readers fall
+ * more than a buffer behind, which is reported but is not an error.
+ *
+ * Usage: logger_bench [-w writers] [-r readers] [-n messages]
+ *		       [-s size] [-d device]
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "logger.h"
+
+#define TAG		"logger_bench"
+#define MAX_WRITERS	64
+#define READ_BUF_SIZE	(5 * 1024)
+
+static int nr_writers = 4;
+static int nr_readers = 2;
+static int nr_msgs = 20000;
+static int msg_size = 64;
+static const char *device = "/dev/log/main";
+
+static volatile int writers_done;
+
+struct reader_state {
+	pthread_t tid;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *writer_thread(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+	char prio = 4;
+	char *msg;
+	struct iovec iov[3];
+	int fd, i;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		perror("open writer");
+		return (void *)1;
+	}
+	msg = malloc(msg_size);
+	memset(msg, 'x', msg_size);
+	msg[msg_size - 1] = '\0';
+
+	iov[0].iov_base = &prio;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = TAG;
+	iov[1].iov_len = sizeof(TAG);
+	iov[2].iov_base = msg;
+	iov[2].iov_len = msg_size;
+	for (i = 0; i < nr_msgs; i++) {
+		int n = snprintf(msg, msg_size, "w=%d seq=%d", id, i);
+
+		if (n < msg_size - 1)
+			msg[n] = ' ';
+		if (writev(fd, iov, 3) < 0) {
+			perror("writev");
+			break;
+		}
+	}
+	free(msg);
+	close(fd);
+	return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader_state *rs = arg;
+	int next_seq[MAX_WRITERS] = { 0 };
+	union {
+		struct logger_entry entry;
+		char buf[READ_BUF_SIZE];
+	} u;
+	struct pollfd pfd;
+	int version = 2;
+	pid_t self = getpid();
+
+	pfd.fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (pfd.fd < 0) {
+		perror("open reader");
+		rs->errors++;
+		return NULL;
+	}
+	pfd.events = POLLIN;
+	ioctl(pfd.fd, LOGGER_SET_VERSION, &version);
+
+	for (;;) {
+		const char *tag, *text;
+		int id, seq;
+		ssize_t n;
+
+		n = read(pfd.fd, &u, sizeof(u));
+		if (n < 0 && errno == EAGAIN) {
+			if (writers_done)
+				break;
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (n < 0) {
+			perror("read");
+			rs->errors++;
+			break;
+		}
+		if (u.entry.pid != self)
+			continue;
+
+		tag = u.entry.msg + 1;
+		text = tag + sizeof(TAG);
+		if (u.entry.len < 1 + sizeof(TAG) ||
+		    strncmp(tag, TAG, sizeof(TAG)) ||
+		    sscanf(text, "w=%d seq=%d", &id, &seq) != 2 ||
+		    id < 0 || id >= nr_writers || seq < next_seq[id]) {
+			rs->errors++;
+			continue;
+		}
+		rs->lost += seq - next_seq[id];
+		next_seq[id] = seq + 1;
+		rs->received++;
+	}
+	close(pfd.fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct reader_state *readers;
+	pthread_t writers[MAX_WRITERS];
+	uint64_t start, elapsed, errors = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "w:r:n:s:d:")) != -1) {
+		switch (opt) {
+		case 'w':
+			nr_writers = atoi(optarg);
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			break;
+		case 'n':
+			nr_msgs = atoi(optarg);
+			break;
+		case 's':
+			msg_size = atoi(optarg);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-w writers] [-r readers] "
+				"[-n messages] [-s size] [-d device]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_writers < 1 || nr_writers > MAX_WRITERS)
+		nr_writers = 4;
+	if (nr_readers < 0)
+		nr_readers = 0;
+	if (msg_size < 32)
+		msg_size = 32;
+	if (msg_size > LOGGER_ENTRY_MAX_PAYLOAD - 1 - (int)sizeof(TAG))
+		msg_size = LOGGER_ENTRY_MAX_PAYLOAD - 1 - sizeof(TAG);
+
+	if (access(device, R_OK | W_OK)) {
+		printf("logger_bench: %s not available, skipping\n", device);
+		return 0;
+	}
+
+	readers = calloc(nr_readers ? nr_readers : 1, sizeof(*readers));
+	for (i = 0; i < nr_readers; i++)
+		pthread_create(&readers[i].tid, NULL, reader_thread,
+			       &readers[i]);
+
+	start = now_ns();
+	for (i = 0; i < nr_writers; i++)
+		pthread_create(&writers[i], NULL, writer_thread,
+			       (void *)(intptr_t)i);
+	for (i = 0; i < nr_writers; i++) {
+		void *ret;
+
+		pthread_join(writers[i], &ret);
+		if (ret)
+			errors++;
+	}
+	elapsed = now_ns() - start;
+	writers_done = 1;
+
+	printf("logger_bench: %d writers x %d messages of %d bytes, "
+	       "%d readers\n", nr_writers, nr_msgs, msg_size, nr_readers);
+	printf("  writes: %llu msgs/s\n",
+	       (unsigned long long)((uint64_t)nr_writers * nr_msgs *
+				    1000000000ULL / (elapsed ? elapsed : 1)));
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(readers[i].tid, NULL);
+		printf("  reader %d: %llu received, %llu lost, %llu bad\n", i,
+		       (unsigned long long)readers[i].received,
+		       (unsigned long long)readers[i].lost,
+		       (unsigned long long)readers[i].errors);
+		errors += readers[i].errors;
+	}
+
+	if (errors) {
+		printf("logger_bench: FAIL\n");
+		return 1;
+	}
+	printf("logger_bench: PASS\n");
+	return 0;
+}
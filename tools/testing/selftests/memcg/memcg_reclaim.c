@@ -0,0 +1,346 @@
+/*
+ * memcg_reclaim: foreground working set retention under a memory hog.
+ *
+ * Two memory cgroups are created next to each other, "fg" and "bg".  A
+ * process in fg keeps a file-backed working set of -f MB mapped and
+ * touches all of it every 200 ms, the way a foreground application
+ * would.  Meanwhile a process in bg streams twice through a file as big
+ * as RAM, so that global reclaim has to take pages from somewhere.  When
+ * the hog is done, the share of the fg working set still in the page
+ * cache is reported.
+ *
+ * This is done twice: once with both groups at the default reclaim
+ * weight, and once with fg at -w fg_weight and bg at -W bg_weight.  The
+ * weighted run has to keep at least as much of the working set as the
+ * unweighted one (within 5 %), otherwise the test fails.
+ *
+ * Needs root and the memory controller mounted.  The files are created
+ * in -d dir, which needs room for RAM + fg MB.
+ *
+ * Usage: memcg_reclaim [-d dir] [-f fg_mbytes] [-m hog_mbytes]
+ *			[-w fg_weight] [-W bg_weight]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define PAGE_SZ		4096
+#define CHUNK		(1 << 20)
+
+static const char *dir = ".";
+static size_t fg_bytes = 64 << 20;
+static size_t hog_bytes;
+static int fg_weight = 25;
+static int bg_weight = 400;
+
+static char memcg_root[256];
+static char fg_path[512], bg_path[512];
+static char fg_file[512], hog_file[512];
+
+static int find_memcg(void)
+{
+	struct mntent *ent;
+	FILE *f = setmntent("/proc/mounts", "r");
+
+	if (!f)
+		return -1;
+	while ((ent = getmntent(f))) {
+		if (!strcmp(ent->mnt_type, "cgroup") &&
+		    hasmntopt(ent, "memory")) {
+			snprintf(memcg_root, sizeof(memcg_root), "%s",
+				 ent->mnt_dir);
+			endmntent(f);
+			return 0;
+		}
+	}
+	endmntent(f);
+	return -1;
+}
+
+static int write_file(const char *group, const char *name, long val)
+{
+	char path[600];
+	FILE *f;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s/%s", group, name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%ld\n", val) < 0;
+	return (fclose(f) || ret) ? -1 : 0;
+}
+
+static size_t mem_total(void)
+{
+	unsigned long kb = 0;
+	char line[128];
+	FILE *f = fopen("/proc/meminfo", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "MemTotal: %lu kB", &kb) == 1)
+			break;
+	fclose(f);
+	return (size_t)kb << 10;
+}
+
+static int create_file(const char *path, size_t len)
+{
+	char *buf = malloc(CHUNK);
+	size_t done;
+	int fd;
+
+	if (!buf)
+		return -1;
+	memset(buf, 0x5a, CHUNK);
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		free(buf);
+		return -1;
+	}
+	for (done = 0; done < len; done += CHUNK) {
+		if (write(fd, buf, CHUNK) != CHUNK) {
+			free(buf);
+			close(fd);
+			return -1;
+		}
+	}
+	free(buf);
+	fsync(fd);
+	close(fd);
+	return 0;
+}
+
+/* Start a round with nothing of either file in the page cache. */
+static void drop_file(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void join(const char *group)
+{
+	if (write_file(group, "tasks", getpid()))
+		_exit(1);
+}
+
+static void foreground(void)
+{
+	volatile unsigned char *p;
+	size_t i;
+	int fd;
+
+	join(fg_path);
+	fd = open(fg_file, O_RDONLY);
+	if (fd < 0)
+		_exit(1);
+	p = mmap(NULL, fg_bytes, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		_exit(1);
+	for (;;) {
+		for (i = 0; i < fg_bytes; i += PAGE_SZ)
+			(void)p[i];
+		usleep(200000);
+	}
+}
+
+static void hog(void)
+{
+	char *buf = malloc(CHUNK);
+	int pass, fd;
+
+	join(bg_path);
+	fd = open(hog_file, O_RDONLY);
+	if (fd < 0 || !buf)
+		_exit(1);
+	for (pass = 0; pass < 2; pass++) {
+		lseek(fd, 0, SEEK_SET);
+		while (read(fd, buf, CHUNK) > 0)
+			;
+	}
+	_exit(0);
+}
+
+/* Percentage of the fg working set resident in the page cache. */
+static double residency(void)
+{
+	size_t pages = fg_bytes / PAGE_SZ, i, resident = 0;
+	unsigned char *vec = malloc(pages);
+	void *p;
+	int fd;
+
+	fd = open(fg_file, O_RDONLY);
+	if (fd < 0 || !vec)
+		return -1;
+	p = mmap(NULL, fg_bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED || mincore(p, fg_bytes, vec)) {
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < pages; i++)
+		resident += vec[i] & 1;
+	munmap(p, fg_bytes);
+	free(vec);
+	return 100.0 * resident / pages;
+}
+
+/* Returns the fg residency in percent, or -1 on error. */
+static double run(int fgw, int bgw)
+{
+	pid_t fg_pid, hog_pid;
+	int status;
+	double ret;
+
+	if (write_file(fg_path, "memory.reclaim_weight", fgw) ||
+	    write_file(bg_path, "memory.reclaim_weight", bgw))
+		return -1;
+	drop_file(fg_file);
+	drop_file(hog_file);
+
+	fg_pid = fork();
+	if (fg_pid < 0)
+		return -1;
+	if (!fg_pid)
+		foreground();
+	/* Let the working set fault in before the hog starts. */
+	sleep(2);
+
+	hog_pid = fork();
+	if (hog_pid < 0) {
+		kill(fg_pid, SIGKILL);
+		waitpid(fg_pid, NULL, 0);
+		return -1;
+	}
+	if (!hog_pid)
+		hog();
+	waitpid(hog_pid, &status, 0);
+
+	ret = residency();
+	kill(fg_pid, SIGKILL);
+	waitpid(fg_pid, NULL, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	return ret;
+}
+
+static void cleanup(void)
+{
+	unlink(fg_file);
+	unlink(hog_file);
+	rmdir(fg_path);
+	rmdir(bg_path);
+}
+
+int main(int argc, char **argv)
+{
+	double plain, weighted;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:f:m:w:W:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'f':
+			fg_bytes = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'm':
+			hog_bytes = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'w':
+			fg_weight = atoi(optarg);
+			break;
+		case 'W':
+			bg_weight = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-f fg_mbytes] "
+				"[-m hog_mbytes] [-w fg_weight] "
+				"[-W bg_weight]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (fg_bytes < CHUNK)
+		fg_bytes = CHUNK;
+	if (!hog_bytes)
+		hog_bytes = mem_total();
+	hog_bytes = (hog_bytes + CHUNK - 1) & ~(size_t)(CHUNK - 1);
+
+	if (geteuid()) {
+		printf("memcg_reclaim: needs root, skipping\n");
+		return 0;
+	}
+	if (find_memcg()) {
+		printf("memcg_reclaim: memory cgroup not mounted, skipping\n");
+		return 0;
+	}
+
+	snprintf(fg_path, sizeof(fg_path), "%s/memcg_reclaim_fg", memcg_root);
+	snprintf(bg_path, sizeof(bg_path), "%s/memcg_reclaim_bg", memcg_root);
+	snprintf(fg_file, sizeof(fg_file), "%s/memcg_reclaim_fg.dat", dir);
+	snprintf(hog_file, sizeof(hog_file), "%s/memcg_reclaim_hog.dat", dir);
+
+	if ((mkdir(fg_path, 0755) && errno != EEXIST) ||
+	    (mkdir(bg_path, 0755) && errno != EEXIST)) {
+		printf("memcg_reclaim: cannot create groups: %s\n",
+		       strerror(errno));
+		return 1;
+	}
+	if (write_file(fg_path, "memory.reclaim_weight", 100)) {
+		printf("memcg_reclaim: no memory.reclaim_weight, skipping\n");
+		rmdir(fg_path);
+		rmdir(bg_path);
+		return 0;
+	}
+	if (create_file(fg_file, fg_bytes) ||
+	    create_file(hog_file, hog_bytes)) {
+		printf("memcg_reclaim: cannot create files in %s: %s\n",
+		       dir, strerror(errno));
+		cleanup();
+		return 1;
+	}
+
+	printf("memcg_reclaim: %zu MB working set, %zu MB hog\n",
+	       fg_bytes >> 20, hog_bytes >> 20);
+	printf("fg weight  bg weight  fg resident\n");
+	plain = run(100, 100);
+	if (plain >= 0)
+		printf("%9d %10d %11.1f%%\n", 100, 100, plain);
+	weighted = plain < 0 ? -1 : run(fg_weight, bg_weight);
+	if (weighted >= 0)
+		printf("%9d %10d %11.1f%%\n", fg_weight, bg_weight, weighted);
+	cleanup();
+
+	if (plain < 0 || weighted < 0) {
+		printf("memcg_reclaim: run failed\n");
+		printf("memcg_reclaim: FAIL\n");
+		return 1;
+	}
+	if (weighted + 5.0 < plain) {
+		printf("memcg_reclaim: weighted run kept less of the "
+		       "working set\n");
+		printf("memcg_reclaim: FAIL\n");
+		return 1;
+	}
+	printf("memcg_reclaim: PASS\n");
+	return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * zram_bench: parallel write/read throughput of a zram device.
+ *
+ * For 1, 2, 4, ... threads up to the number of CPUs, every thread writes
+ * its own slice of the device with O_DIRECT page-sized writes, then reads
+ * it back and checks the contents.  The page contents are generated so
+ * that they compress roughly 2:1 with LZO, like typical anonymous
+ * memory.  Throughput should scale with the thread count up to
+ * max_comp_streams.
+ *
+ * The device must have been given a disksize and must not be in use (it
+ * is opened with O_EXCL, so an active swap device is refused).  Its
+ * contents are destroyed.
+ *
+ * Usage: zram_bench [-d device] [-m megabytes] [-t max_threads]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <linux/fs.h>
+
+#define PAGE_SZ		4096
+#define PAGES_PER_IO	16
+
+static const char *device = "/dev/zram0";
+static uint64_t total_bytes = 64ULL << 20;
+
+struct worker {
+	pthread_t tid;
+	int fd;
+	uint64_t first_page;
+	uint64_t nr_pages;
+	int write;
+	uint64_t errors;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Half pseudo-random bytes, half a repeating pattern. */
+static void fill_page(unsigned char *p, uint64_t page)
+{
+	uint32_t x = (uint32_t)(page * 2654435761u) | 1;
+	int i;
+
+	for (i = 0; i < PAGE_SZ; i++) {
+		if ((i / 64) & 1) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			p[i] = x;
+		} else {
+			p[i] = "zram_bench"[i % 10];
+		}
+	}
+	memcpy(p, &page, sizeof(page));
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char *buf, *ref;
+	uint64_t page, end = w->first_page + w->nr_pages;
+	size_t len = PAGE_SZ * PAGES_PER_IO;
+	int i;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, len) ||
+	    posix_memalign((void **)&ref, PAGE_SZ, PAGE_SZ)) {
+		w->errors++;
+		return NULL;
+	}
+
+	for (page = w->first_page; page < end; page += PAGES_PER_IO) {
+		off_t off = (off_t)page * PAGE_SZ;
+
+		if (w->write) {
+			for (i = 0; i < PAGES_PER_IO; i++)
+				fill_page(buf + i * PAGE_SZ, page + i);
+			if (pwrite(w->fd, buf, len, off) != (ssize_t)len)
+				w->errors++;
+			continue;
+		}
+
+		if (pread(w->fd, buf, len, off) != (ssize_t)len) {
+			w->errors++;
+			continue;
+		}
+		for (i = 0; i < PAGES_PER_IO; i++) {
+			fill_page(ref, page + i);
+			if (memcmp(ref, buf + i * PAGE_SZ, PAGE_SZ))
+				w->errors++;
+		}
+	}
+
+	free(buf);
+	free(ref);
+	return NULL;
+}
+
+/* Returns MB/s, or a negative value on error. */
+static double run(int fd, int nr_threads, int write, uint64_t *errors)
+{
+	struct worker w[nr_threads];
+	uint64_t nr_pages = total_bytes / PAGE_SZ;
+	uint64_t per_thread = nr_pages / nr_threads / PAGES_PER_IO *
+			      PAGES_PER_IO;
+	uint64_t start, elapsed;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		w[i].fd = fd;
+		w[i].first_page = i * per_thread;
+		w[i].nr_pages = per_thread;
+		w[i].write = write;
+		w[i].errors = 0;
+		if (pthread_create(&w[i].tid, NULL, worker_fn, &w[i]))
+			return -1;
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(w[i].tid, NULL);
+		*errors += w[i].errors;
+	}
+	if (write && fsync(fd))
+		return -1;
+	elapsed = now_ns() - start;
+
+	return (double)(per_thread * nr_threads * PAGE_SZ) /
+	       (1 << 20) / (elapsed / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double base_w = 0, base_r = 0;
+	uint64_t disksize, errors = 0;
+	int fd, opt, n;
+
+	while ((opt = getopt(argc, argv, "d:m:t:")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'm':
+			total_bytes = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d device] [-m megabytes] "
+				"[-t max_threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (max_threads < 1)
+		max_threads = 1;
+
+	fd = open(device, O_RDWR | O_DIRECT | O_EXCL);
+	if (fd < 0) {
+		printf("zram_bench: %s not available (%s), skipping\n",
+		       device, strerror(errno));
+		return 0;
+	}
+	if (ioctl(fd, BLKGETSIZE64, &disksize) || !disksize) {
+		printf("zram_bench: %s has no disksize, skipping\n", device);
+		close(fd);
+		return 0;
+	}
+	if (total_bytes > disksize)
+		total_bytes = disksize;
+
+	printf("zram_bench: %s, %llu MB per run\n", device,
+	       (unsigned long long)(total_bytes >> 20));
+	printf("threads   write MB/s  scaling   read MB/s  scaling\n");
+	for (n = 1; ; n *= 2) {
+		double wr, rd;
+
+		if (n > max_threads)
+			n = max_threads;
+
+		wr = run(fd, n, 1, &errors);
+		rd = run(fd, n, 0, &errors);
+		if (wr < 0 || rd < 0) {
+			printf("zram_bench: I/O setup failed: %s\n",
+			       strerror(errno));
+			close(fd);
+			return 1;
+		}
+		if (n == 1) {
+			base_w = wr;
+			base_r = rd;
+		}
+		printf("%7d %12.1f %7.2fx %11.1f %7.2fx\n", n, wr, wr / base_w,
+		       rd, rd / base_r);
+		if (n == max_threads)
+			break;
+	}
+	close(fd);
+
+	if (errors) {
+		printf("zram_bench: %llu I/O or data errors\n",
+		       (unsigned long long)errors);
+		printf("zram_bench: FAIL\n");
+		return 1;
+	}
+	printf("zram_bench: PASS\n");
+	return 0;
+}